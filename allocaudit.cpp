@@ -0,0 +1,153 @@
+#include "allocaudit.h"
+
+const char* framePhaseName(FramePhase phase) {
+	switch (phase) {
+	case FramePhase::Simulate: return "simulate";
+	case FramePhase::Extraction: return "extraction";
+	case FramePhase::Upload: return "upload";
+	case FramePhase::Spawn: return "spawn";
+	default: return "other";
+	}
+}
+
+#ifdef ALLOCATION_AUDIT
+#include <atomic>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+enum ThreadMode : int {
+	ThreadUnwatched,
+	ThreadWatched,
+	ThreadSpawn
+};
+
+// plain arrays of atomics: nothing here may allocate, it runs inside operator new
+static std::atomic<unsigned int> currentPhase((unsigned int)FramePhase::Other);
+static std::atomic<unsigned long long> allocationCounts[(unsigned int)FramePhase::Count];
+static std::atomic<unsigned long long> allocationBytes[(unsigned int)FramePhase::Count];
+static std::atomic<unsigned long long> freeCounts[(unsigned int)FramePhase::Count];
+static thread_local int threadMode = ThreadUnwatched;
+
+static unsigned int threadPhase() {
+	return threadMode == ThreadSpawn ? (unsigned int)FramePhase::Spawn : currentPhase.load(std::memory_order_relaxed);
+}
+
+static void countAllocation(unsigned int phase, size_t bytes) {
+	allocationCounts[phase].fetch_add(1, std::memory_order_relaxed);
+	allocationBytes[phase].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void auditWatchThread() {
+	threadMode = ThreadWatched;
+}
+
+void auditSpawnThread() {
+	threadMode = ThreadSpawn;
+}
+
+FramePhase auditPhase(FramePhase phase) {
+	return (FramePhase)currentPhase.exchange((unsigned int)phase, std::memory_order_relaxed);
+}
+
+void auditPhysXAllocation(size_t bytes) {
+	countAllocation(threadPhase(), bytes);
+}
+
+void auditPhysXFree() {
+	freeCounts[threadPhase()].fetch_add(1, std::memory_order_relaxed);
+}
+
+bool AllocationAudit::endFrame(FILE* log) {
+	frame++;
+	bool clean = true;
+	for (unsigned int p = 0; p < (unsigned int)FramePhase::Count; p++) {
+		PhaseAllocations counts;
+		counts.allocations = allocationCounts[p].exchange(0, std::memory_order_relaxed);
+		counts.bytes = allocationBytes[p].exchange(0, std::memory_order_relaxed);
+		counts.frees = freeCounts[p].exchange(0, std::memory_order_relaxed);
+		totals[p].allocations += counts.allocations;
+		totals[p].bytes += counts.bytes;
+		totals[p].frees += counts.frees;
+
+		if (frame <= warmupFrames || p == (unsigned int)FramePhase::Spawn || counts.allocations == 0) continue;
+		clean = false;
+		if (log) {
+			fprintf(log, "frame %u: %s allocated %llu times, %llu bytes (%llu frees)\n",
+				frame, framePhaseName((FramePhase)p), counts.allocations, counts.bytes, counts.frees);
+		}
+	}
+	if (!clean) {
+		failures++;
+		if (log) fflush(log);
+	}
+	return clean;
+}
+
+// global new/delete, counted on watched threads and forwarded to malloc/free
+static void* countedNew(size_t size) {
+	if (threadMode != ThreadUnwatched) countAllocation(threadPhase(), size);
+	return malloc(size ? size : 1);
+}
+
+static void countedDelete(void* ptr) {
+	if (!ptr) return;
+	if (threadMode != ThreadUnwatched) freeCounts[threadPhase()].fetch_add(1, std::memory_order_relaxed);
+	free(ptr);
+}
+
+void* operator new(size_t size) {
+	void* ptr = countedNew(size);
+	if (!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](size_t size) {
+	void* ptr = countedNew(size);
+	if (!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return countedNew(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return countedNew(size); }
+void operator delete(void* ptr) noexcept { countedDelete(ptr); }
+void operator delete[](void* ptr) noexcept { countedDelete(ptr); }
+void operator delete(void* ptr, size_t) noexcept { countedDelete(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { countedDelete(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { countedDelete(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { countedDelete(ptr); }
+
+// over-aligned types, C++17 routes them here instead of the plain forms
+static void* countedAlignedNew(size_t size, std::align_val_t alignment) {
+	if (threadMode != ThreadUnwatched) countAllocation(threadPhase(), size);
+	return _aligned_malloc(size ? size : 1, (size_t)alignment);
+}
+
+static void countedAlignedDelete(void* ptr) {
+	if (!ptr) return;
+	if (threadMode != ThreadUnwatched) freeCounts[threadPhase()].fetch_add(1, std::memory_order_relaxed);
+	_aligned_free(ptr);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+	void* ptr = countedAlignedNew(size, alignment);
+	if (!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+	void* ptr = countedAlignedNew(size, alignment);
+	if (!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return countedAlignedNew(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return countedAlignedNew(size, alignment); }
+void operator delete(void* ptr, std::align_val_t) noexcept { countedAlignedDelete(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { countedAlignedDelete(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { countedAlignedDelete(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { countedAlignedDelete(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { countedAlignedDelete(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { countedAlignedDelete(ptr); }
+
+#endif
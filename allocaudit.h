@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <cstdio>
+
+// parts of the frame loop allocations are charged to. Spawn covers everything that
+// adds or restructures bodies (spawning, world streaming, static batch baking) and is
+// the only phase allowed to allocate once the loop has warmed up
+enum class FramePhase : unsigned int {
+	Other,
+	Simulate,
+	Extraction,
+	Upload,
+	Spawn,
+	Count
+};
+
+struct PhaseAllocations {
+	unsigned long long allocations;
+	unsigned long long bytes;
+	unsigned long long frees;
+};
+
+const char* framePhaseName(FramePhase phase);
+
+// build with ALLOCATION_AUDIT defined to replace global new/delete and the PhysX
+// allocator with counting versions, without it every call below compiles to nothing
+#ifdef ALLOCATION_AUDIT
+
+// new/delete are only counted on watched threads, PhysX allocations on any thread
+// (its workers run the simulate phase). A spawn thread charges everything to Spawn
+void auditWatchThread();
+void auditSpawnThread();
+// sets the phase for every thread that follows the main loop, returns the previous one
+FramePhase auditPhase(FramePhase phase);
+void auditPhysXAllocation(size_t bytes);
+void auditPhysXFree();
+
+// checks the counts of one frame against the zero allocation rule
+class AllocationAudit {
+public:
+	unsigned int warmupFrames = 300; // containers reach their working size here
+
+	// writes a line per offending phase to the log, returns false when the frame allocated
+	bool endFrame(FILE* log);
+	unsigned int failedFrames() const { return failures; }
+	// totals since startup, warmup included
+	const PhaseAllocations& total(FramePhase phase) const { return totals[(unsigned int)phase]; }
+
+private:
+	unsigned int frame = 0;
+	unsigned int failures = 0;
+	PhaseAllocations totals[(unsigned int)FramePhase::Count] = {};
+};
+
+#else
+
+inline void auditWatchThread() {}
+inline void auditSpawnThread() {}
+inline FramePhase auditPhase(FramePhase) { return FramePhase::Other; }
+
+#endif
+
+// charges one block to a phase and restores the previous one on exit, for restructuring
+// that happens inside a function the caller runs in a stricter phase
+class AuditPhaseScope {
+public:
+	explicit AuditPhaseScope(FramePhase phase) : previous(auditPhase(phase)) {}
+	~AuditPhaseScope() { auditPhase(previous); }
+	AuditPhaseScope(const AuditPhaseScope&) = delete;
+	AuditPhaseScope& operator=(const AuditPhaseScope&) = delete;
+
+private:
+	FramePhase previous;
+};
@@ -0,0 +1,288 @@
+#include "crowd.h"
+#include "physics.h"
+#include <chrono>
+#include <cmath>
+
+using namespace physx;
+
+// PhysX capsules run along x, characters stand along y
+static const PxQuat capsuleRotation(PxHalfPi, PxVec3(0.0f, 0.0f, 1.0f));
+
+// agents stay visible to everyone else's queries (the player controller collides with
+// them) but never block their own sweeps, they see each other through the grid instead
+class IgnoreAgentsFilter : public PxQueryFilterCallback {
+public:
+	PxQueryHitType::Enum preFilter(const PxFilterData&, const PxShape* shape, const PxRigidActor*, PxHitFlags&) override {
+		return (shape->getSimulationFilterData().word0 & BodyKindAgent) ? PxQueryHitType::eNONE : PxQueryHitType::eBLOCK;
+	}
+	PxQueryHitType::Enum postFilter(const PxFilterData&, const PxQueryHit&) override {
+		return PxQueryHitType::eBLOCK;
+	}
+};
+static IgnoreAgentsFilter ignoreAgents;
+
+Crowd::Crowd(PxPhysics& physics, PxScene& scene, PxMaterial& material, JobPool& jobs)
+	: physics(physics), scene(scene), material(material), jobs(jobs) {
+}
+
+Crowd::~Crowd() {
+	for (PxRigidDynamic* actor : actors) actor->release();
+}
+
+PxQueryFilterData Crowd::sweepFilter() const {
+	PxQueryFlags flags = settings.blockOnDynamics ? (PxQueryFlag::eSTATIC | PxQueryFlag::eDYNAMIC) : PxQueryFlags(PxQueryFlag::eSTATIC);
+	return PxQueryFilterData(flags | PxQueryFlag::ePREFILTER);
+}
+
+PxCapsuleGeometry Crowd::geometry() const {
+	return PxCapsuleGeometry(settings.radius, settings.height * 0.5f);
+}
+
+PxVec3 Crowd::center(size_t agent) const {
+	return positions[agent] + PxVec3(0.0f, settings.radius + settings.height * 0.5f, 0.0f);
+}
+
+PxVec3 Crowd::randomGoal(size_t agent) {
+	// xorshift per agent so goals don't depend on which thread asked first
+	unsigned int& seed = seeds[agent];
+	auto next = [&seed]() {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		return (seed & 0xFFFFFF) / (float)0xFFFFFF;
+	};
+	float x = settings.wanderMin.x + (settings.wanderMax.x - settings.wanderMin.x) * next();
+	float z = settings.wanderMin.z + (settings.wanderMax.z - settings.wanderMin.z) * next();
+	return PxVec3(x, 0.0f, z);
+}
+
+unsigned int Crowd::add(const PxVec3& footPosition) {
+	unsigned int agent = (unsigned int)positions.size();
+
+	positions.push_back(footPosition);
+	nextPositions.push_back(footPosition);
+	fallSpeeds.push_back(0.0f);
+	seeds.push_back(0x9E3779B9u ^ (agent * 2654435761u) ^ 1u);
+	goals.push_back(PxVec3(0.0f));
+	goals[agent] = randomGoal(agent);
+
+	PxRigidDynamic* actor = physics.createRigidDynamic(PxTransform(center(agent), capsuleRotation));
+	actor->setRigidBodyFlag(PxRigidBodyFlag::eKINEMATIC, true);
+	PxShape* shape = physics.createShape(geometry(), material, true);
+	shape->setSimulationFilterData(PxFilterData(BodyKindAgent, 0, 0, 0));
+	actor->attachShape(*shape);
+	shape->release();
+	scene.addActor(*actor);
+	actors.push_back(actor);
+
+	return agent;
+}
+
+void Crowd::setObstacle(const PxVec3& footPosition, float radius) {
+	hasObstacle = true;
+	obstaclePosition = footPosition;
+	obstacleRadius = radius;
+}
+
+unsigned int Crowd::cellOf(int x, int z) const {
+	unsigned int h = ((unsigned int)x * 73856093u) ^ ((unsigned int)z * 19349663u);
+	return h & (unsigned int)(cellStart.size() - 2);
+}
+
+void Crowd::buildGrid() {
+	cellSize = PxMax(settings.radius * 2.0f, 0.5f);
+
+	size_t buckets = 64;
+	while (buckets < positions.size() * 2) buckets <<= 1;
+	cellStart.assign(buckets + 1, 0);
+	cellAgents.resize(positions.size());
+	agentCell.resize(positions.size());
+
+	for (size_t i = 0; i < positions.size(); i++) {
+		int x = (int)floorf(positions[i].x / cellSize);
+		int z = (int)floorf(positions[i].z / cellSize);
+		agentCell[i] = cellOf(x, z);
+		cellStart[agentCell[i] + 1]++;
+	}
+	for (size_t b = 0; b < buckets; b++) cellStart[b + 1] += cellStart[b];
+
+	// assign keeps the capacity, the step itself never allocates
+	cellCursor.assign(cellStart.begin(), cellStart.end() - 1);
+	for (size_t i = 0; i < positions.size(); i++) {
+		cellAgents[cellCursor[agentCell[i]]++] = (unsigned int)i;
+	}
+}
+
+PxVec3 Crowd::slide(const PxVec3& foot, PxVec3 displacement) const {
+	PxQueryFilterData filter = sweepFilter();
+	PxCapsuleGeometry capsule = geometry();
+	PxVec3 up(0.0f, settings.radius + settings.height * 0.5f, 0.0f);
+	PxVec3 position = foot;
+
+	for (unsigned int i = 0; i < settings.slideIterations; i++) {
+		float length = displacement.magnitude();
+		if (length < 1e-5f) break;
+		PxVec3 direction = displacement / length;
+
+		PxSweepBuffer hit;
+		PxTransform pose(position + up, capsuleRotation);
+		if (!scene.sweep(capsule, pose, direction, length + settings.contactOffset, hit, PxHitFlag::eDEFAULT | PxHitFlag::eMTD, filter, &ignoreAgents)) {
+			position += displacement;
+			break;
+		}
+
+		const PxSweepHit& block = hit.block;
+		if (block.hadInitialOverlap()) {
+			// already penetrating, step out along the MTD and try again
+			position += block.normal * (PxAbs(block.distance) + settings.contactOffset);
+			continue;
+		}
+
+		float travel = PxMax(block.distance - settings.contactOffset, 0.0f);
+		position += direction * travel;
+		PxVec3 remaining = displacement - direction * travel;
+		displacement = remaining - block.normal * remaining.dot(block.normal);
+	}
+	return position;
+}
+
+void Crowd::moveAgent(size_t agent, float dt) {
+	const PxVec3 position = positions[agent];
+	const float minDistance = settings.radius * 2.0f;
+
+	PxVec3 toGoal = goals[agent] - position;
+	toGoal.y = 0.0f;
+	if (toGoal.magnitudeSquared() < 0.25f) {
+		goals[agent] = randomGoal(agent);
+		toGoal = goals[agent] - position;
+		toGoal.y = 0.0f;
+	}
+	PxVec3 move = toGoal.getNormalized() * settings.speed * dt;
+
+	// each overlapping pair is split half/half, both sides see the same previous positions
+	PxVec3 push(0.0f);
+	int cx = (int)floorf(position.x / cellSize);
+	int cz = (int)floorf(position.z / cellSize);
+	unsigned int visited[9];
+	int visitedCount = 0;
+	for (int dx = -1; dx <= 1; dx++) {
+		for (int dz = -1; dz <= 1; dz++) {
+			unsigned int cell = cellOf(cx + dx, cz + dz);
+			bool seen = false;
+			for (int v = 0; v < visitedCount; v++) seen |= visited[v] == cell;
+			if (seen) continue;
+			visited[visitedCount++] = cell;
+
+			for (unsigned int k = cellStart[cell]; k < cellStart[cell + 1]; k++) {
+				unsigned int other = cellAgents[k];
+				if (other == agent) continue;
+				PxVec3 delta = position - positions[other];
+				if (PxAbs(delta.y) > settings.height + minDistance) continue;
+				delta.y = 0.0f;
+				float distance = delta.magnitude();
+				if (distance >= minDistance) continue;
+				PxVec3 normal = distance > 1e-4f ? delta / distance : PxVec3(agent < other ? 1.0f : -1.0f, 0.0f, 0.0f);
+				push += normal * (minDistance - distance) * 0.5f;
+			}
+		}
+	}
+
+	if (hasObstacle) {
+		PxVec3 delta = position - obstaclePosition;
+		delta.y = 0.0f;
+		float distance = delta.magnitude();
+		float limit = settings.radius + obstacleRadius;
+		if (distance < limit && distance > 1e-4f) push += delta / distance * (limit - distance);
+	}
+
+	// horizontal moves happen one step offset up so low ledges get climbed,
+	// then a downward sweep puts the agent back on whatever is below
+	PxVec3 raised = position + PxVec3(0.0f, settings.stepOffset, 0.0f);
+	PxVec3 moved = slide(raised, move + push);
+
+	fallSpeeds[agent] += settings.gravity * dt;
+	float drop = -fallSpeeds[agent] * dt;
+	float probe = settings.stepOffset + PxMax(drop, 0.0f);
+
+	PxQueryFilterData filter = sweepFilter();
+	PxSweepBuffer hit;
+	PxTransform pose(moved + PxVec3(0.0f, settings.radius + settings.height * 0.5f, 0.0f), capsuleRotation);
+	if (scene.sweep(geometry(), pose, PxVec3(0.0f, -1.0f, 0.0f), probe + settings.contactOffset, hit, PxHitFlag::eDEFAULT | PxHitFlag::eMTD, filter, &ignoreAgents)) {
+		const PxSweepHit& block = hit.block;
+		if (block.hadInitialOverlap()) moved += block.normal * (PxAbs(block.distance) + settings.contactOffset);
+		else moved.y -= PxMax(block.distance - settings.contactOffset, 0.0f);
+		fallSpeeds[agent] = 0.0f;
+	}
+	else {
+		moved.y -= probe;
+	}
+
+	nextPositions[agent] = moved;
+}
+
+void Crowd::step(float dt) {
+	if (positions.empty()) return;
+
+	buildGrid();
+	jobs.parallelFor(positions.size(), 64, [this, dt](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) moveAgent(i, dt);
+	});
+	positions.swap(nextPositions);
+
+	// the only scene writes, kept on the calling thread
+	for (size_t i = 0; i < actors.size(); i++) {
+		actors[i]->setKinematicTarget(PxTransform(center(i), capsuleRotation));
+	}
+}
+
+void runCrowdBenchmark(FILE* out) {
+	const unsigned int counts[] = { 100, 250, 500, 1000, 2000, 4000 };
+	const int warmupSteps = 30;
+	const int measuredSteps = 300;
+	const float timeStep = 1.0f / 60.0f;
+
+	JobPool jobs;
+	fprintf(out, "crowd benchmark, %u threads, %d steps per count\n", jobs.threadCount(), measuredSteps);
+
+	for (unsigned int count : counts) {
+		std::vector<PxRigidDynamic*> pile;
+		for (int k = 0; k < 10; k++) {
+			for (int i = 0; i < 10; i++) {
+				for (int j = 0; j < 10; j++) {
+					pile.push_back(createPxCube(PxVec3(i * 1.f, 0.1f + k * 1.05f, j * 1.f), PxVec3(0.5f, 0.5f, 0.5f)));
+				}
+			}
+		}
+
+		{
+			Crowd crowd(*gPhysics, *gScene, *gMaterial, jobs);
+			crowd.settings.wanderMin = PxVec3(-10.0f, 0.0f, -10.0f);
+			crowd.settings.wanderMax = PxVec3(20.0f, 0.0f, 20.0f);
+			unsigned int side = (unsigned int)ceilf(sqrtf((float)count));
+			for (unsigned int a = 0; a < count; a++) {
+				crowd.add(PxVec3(15.0f + (a % side) * 1.2f, 0.0f, -10.0f + (a / side) * 1.2f));
+			}
+
+			double crowdMs = 0.0, simulateMs = 0.0;
+			for (int s = 0; s < warmupSteps + measuredSteps; s++) {
+				auto t0 = std::chrono::high_resolution_clock::now();
+				crowd.step(timeStep);
+				auto t1 = std::chrono::high_resolution_clock::now();
+				gScene->simulate(timeStep);
+				gScene->fetchResults(true);
+				auto t2 = std::chrono::high_resolution_clock::now();
+
+				if (s >= warmupSteps) {
+					crowdMs += std::chrono::duration<double, std::milli>(t1 - t0).count();
+					simulateMs += std::chrono::duration<double, std::milli>(t2 - t1).count();
+				}
+			}
+
+			fprintf(out, "controllers %5u  crowd %8.3f ms/step  simulate %8.3f ms/step\n",
+				count, crowdMs / measuredSteps, simulateMs / measuredSteps);
+			fflush(out);
+		}
+
+		for (PxRigidDynamic* body : pile) body->release();
+	}
+}
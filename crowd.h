@@ -0,0 +1,75 @@
+#pragma once
+#include <PxPhysicsAPI.h>
+#include <vector>
+#include <cstdio>
+#include "jobs.h"
+
+struct CrowdSettings {
+	float radius = 0.4f;
+	float height = 1.8f;          // cylinder part, same meaning as PxCapsuleControllerDesc::height
+	float speed = 2.5f;
+	float stepOffset = 0.3f;
+	float contactOffset = 0.05f;
+	float gravity = -9.81f;
+	unsigned int slideIterations = 3;
+	bool blockOnDynamics = false; // false: agents shove dynamic bodies aside instead of stopping at them
+	physx::PxVec3 wanderMin = physx::PxVec3(-20.0f, 0.0f, -20.0f);
+	physx::PxVec3 wanderMax = physx::PxVec3(30.0f, 0.0f, 30.0f);
+};
+
+// batched kinematic capsule characters, moved together across worker threads.
+// sweeps only read the scene, agent/agent pushes are resolved from the previous
+// positions so the result doesn't depend on thread scheduling, and the kinematic
+// targets are written back serially at the end of the step
+class Crowd {
+public:
+	CrowdSettings settings;
+
+	Crowd(physx::PxPhysics& physics, physx::PxScene& scene, physx::PxMaterial& material, JobPool& jobs);
+	~Crowd();
+
+	unsigned int add(const physx::PxVec3& footPosition);
+	// something agents keep away from without being able to push it, e.g. the player
+	void setObstacle(const physx::PxVec3& footPosition, float radius);
+	// call between fetchResults and the next simulate
+	void step(float dt);
+
+	size_t size() const { return positions.size(); }
+	const physx::PxVec3& footPosition(size_t agent) const { return positions[agent]; }
+	physx::PxVec3 center(size_t agent) const;
+
+private:
+	physx::PxPhysics& physics;
+	physx::PxScene& scene;
+	physx::PxMaterial& material;
+	JobPool& jobs;
+
+	std::vector<physx::PxVec3> positions;
+	std::vector<physx::PxVec3> nextPositions;
+	std::vector<physx::PxVec3> goals;
+	std::vector<float> fallSpeeds;
+	std::vector<unsigned int> seeds;
+	std::vector<physx::PxRigidDynamic*> actors;
+
+	// spatial hash over the previous positions, rebuilt every step
+	std::vector<unsigned int> cellStart;
+	std::vector<unsigned int> cellAgents;
+	std::vector<unsigned int> agentCell;
+	std::vector<unsigned int> cellCursor;
+	float cellSize = 1.0f;
+
+	bool hasObstacle = false;
+	physx::PxVec3 obstaclePosition;
+	float obstacleRadius = 0.0f;
+
+	physx::PxCapsuleGeometry geometry() const;
+	physx::PxQueryFilterData sweepFilter() const;
+	unsigned int cellOf(int x, int z) const;
+	void buildGrid();
+	void moveAgent(size_t agent, float dt);
+	physx::PxVec3 slide(const physx::PxVec3& foot, physx::PxVec3 displacement) const;
+	physx::PxVec3 randomGoal(size_t agent);
+};
+
+// ms per step against controller count, written to out
+void runCrowdBenchmark(FILE* out);
@@ -0,0 +1,151 @@
+#include "events.h"
+#include "allocaudit.h"
+#include <chrono>
+
+using namespace physx;
+
+static unsigned char shapeKind(const PxShape* shape) {
+	return (unsigned char)shape->getSimulationFilterData().word0;
+}
+
+static unsigned char actorKind(const PxActor* actor) {
+	const PxRigidActor* rigid = actor->is<PxRigidActor>();
+	if (!rigid || rigid->getNbShapes() == 0) return 0;
+	PxShape* shape = nullptr;
+	rigid->getShapes(&shape, 1);
+	return shapeKind(shape);
+}
+
+bool EventFilter::accepts(const PhysicsEvent& event) const {
+	if (!(types & (1u << (unsigned int)event.type))) return false;
+	if (event.type == PhysicsEventType::Contact && event.impulse < minImpulse) return false;
+
+	bool forward = (kinds & event.kind0) && (otherKinds & event.kind1);
+	bool backward = (kinds & event.kind1) && (otherKinds & event.kind0);
+	// sleep/wake events only have one side
+	if (event.type == PhysicsEventType::Wake || event.type == PhysicsEventType::Sleep) return (kinds & event.kind0) != 0;
+	return forward || backward;
+}
+
+EventConsumer::~EventConsumer() {
+	stop();
+}
+
+void EventConsumer::start(std::function<void(const PhysicsEvent&)> eventHandler) {
+	handler = eventHandler;
+	running = true;
+	thread = std::thread([this]() {
+		auditWatchThread();
+		PhysicsEvent event;
+		while (running.load(std::memory_order_relaxed)) {
+			bool any = false;
+			while (ring.pop(event)) {
+				handler(event);
+				any = true;
+			}
+			if (!any) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+}
+
+void EventConsumer::stop() {
+	if (!running) return;
+	running = false;
+	thread.join();
+}
+
+bool EventConsumer::offer(const PhysicsEvent& event) {
+	if (!filter.accepts(event)) return true;
+	if (ring.push(event)) return true;
+	droppedCount.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+bool EventStream::addConsumer(EventConsumer& consumer) {
+	if (consumerCount == MaxConsumers) return false;
+	consumers[consumerCount++] = &consumer;
+	return true;
+}
+
+void EventStream::publish(const PhysicsEvent& event) {
+	for (unsigned int i = 0; i < consumerCount; i++) consumers[i]->offer(event);
+}
+
+void EventStream::onContact(const PxContactPairHeader& pairHeader, const PxContactPair* pairs, PxU32 nbPairs) {
+	if (pairHeader.flags & (PxContactPairHeaderFlag::eREMOVED_ACTOR_0 | PxContactPairHeaderFlag::eREMOVED_ACTOR_1)) return;
+
+	const PxU32 maxPoints = 16;
+	PxContactPairPoint points[maxPoints];
+
+	for (PxU32 i = 0; i < nbPairs; i++) {
+		const PxContactPair& pair = pairs[i];
+		if (pair.flags & (PxContactPairFlag::eREMOVED_SHAPE_0 | PxContactPairFlag::eREMOVED_SHAPE_1)) continue;
+
+		PhysicsEvent event;
+		event.type = PhysicsEventType::Contact;
+		event.kind0 = shapeKind(pair.shapes[0]);
+		event.kind1 = shapeKind(pair.shapes[1]);
+		event.frame = currentFrame;
+		event.actor0 = pairHeader.actors[0];
+		event.actor1 = pairHeader.actors[1];
+
+		PxU32 count = pair.extractContacts(points, maxPoints);
+		PxVec3 position(0.0f), normal(0.0f);
+		float impulse = 0.0f;
+		for (PxU32 p = 0; p < count; p++) {
+			position += points[p].position;
+			normal += points[p].normal;
+			impulse += points[p].impulse.magnitude();
+		}
+		if (count > 0) {
+			position /= (float)count;
+			normal.normalizeSafe();
+		}
+
+		event.pointCount = (unsigned char)count;
+		event.impulse = impulse;
+		event.position[0] = position.x; event.position[1] = position.y; event.position[2] = position.z;
+		event.normal[0] = normal.x; event.normal[1] = normal.y; event.normal[2] = normal.z;
+		publish(event);
+	}
+}
+
+void EventStream::onTrigger(PxTriggerPair* pairs, PxU32 count) {
+	for (PxU32 i = 0; i < count; i++) {
+		const PxTriggerPair& pair = pairs[i];
+		if (pair.flags & (PxTriggerPairFlag::eREMOVED_SHAPE_TRIGGER | PxTriggerPairFlag::eREMOVED_SHAPE_OTHER)) continue;
+
+		PhysicsEvent event = {};
+		event.type = pair.status == PxPairFlag::eNOTIFY_TOUCH_LOST ? PhysicsEventType::TriggerExit : PhysicsEventType::TriggerEnter;
+		event.kind0 = shapeKind(pair.triggerShape);
+		event.kind1 = shapeKind(pair.otherShape);
+		event.frame = currentFrame;
+		event.actor0 = pair.triggerActor;
+		event.actor1 = pair.otherActor;
+		PxVec3 p = pair.otherActor->getGlobalPose().p;
+		event.position[0] = p.x; event.position[1] = p.y; event.position[2] = p.z;
+		publish(event);
+	}
+}
+
+void EventStream::onWake(PxActor** actors, PxU32 count) {
+	for (PxU32 i = 0; i < count; i++) {
+		PhysicsEvent event = {};
+		event.type = PhysicsEventType::Wake;
+		event.kind0 = actorKind(actors[i]);
+		event.frame = currentFrame;
+		event.actor0 = actors[i];
+		publish(event);
+	}
+}
+
+void EventStream::onSleep(PxActor** actors, PxU32 count) {
+	for (PxU32 i = 0; i < count; i++) {
+		PhysicsEvent event = {};
+		event.type = PhysicsEventType::Sleep;
+		event.kind0 = actorKind(actors[i]);
+		event.frame = currentFrame;
+		event.actor0 = actors[i];
+		publish(event);
+	}
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <PxPhysicsAPI.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+
+enum class PhysicsEventType : unsigned char {
+	Contact,
+	TriggerEnter,
+	TriggerExit,
+	Wake,
+	Sleep
+};
+
+// fixed size record, everything a consumer needs without touching the scene
+struct PhysicsEvent {
+	PhysicsEventType type;
+	unsigned char kind0;  // BodyKind of each side, 0 when unknown
+	unsigned char kind1;
+	unsigned char pointCount;
+	unsigned int frame;
+	float impulse;        // summed normal impulse, 0 for non contact events
+	float position[3];
+	float normal[3];
+	const void* actor0;   // identity only, the actor may be gone by the time this is read
+	const void* actor1;
+};
+
+// single producer / single consumer ring, push never blocks. The slots are allocated
+// once on the heap, large rings can't blow the stack of whoever owns one
+template <typename T, unsigned int Capacity>
+class SpscRing {
+	static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+public:
+	bool push(const T& item) {
+		unsigned int head = writeIndex.load(std::memory_order_relaxed);
+		if (head - readIndex.load(std::memory_order_acquire) == Capacity) return false;
+		items[head & (Capacity - 1)] = item;
+		writeIndex.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& item) {
+		unsigned int tail = readIndex.load(std::memory_order_relaxed);
+		if (tail == writeIndex.load(std::memory_order_acquire)) return false;
+		item = items[tail & (Capacity - 1)];
+		readIndex.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	const std::unique_ptr<T[]> items{ new T[Capacity] };
+	alignas(64) std::atomic<unsigned int> writeIndex{ 0 };
+	alignas(64) std::atomic<unsigned int> readIndex{ 0 };
+};
+
+struct EventFilter {
+	unsigned int types = 0xFFFFFFFF;  // bit per PhysicsEventType
+	unsigned int kinds = 0xFFFFFFFF;  // at least one side of the pair must be one of these BodyKinds
+	unsigned int otherKinds = 0xFFFFFFFF; // and the other side one of these
+	float minImpulse = 0.0f;          // contacts only
+
+	bool accepts(const PhysicsEvent& event) const;
+};
+
+// drains its own ring on its own thread
+class EventConsumer {
+public:
+	EventFilter filter;
+
+	~EventConsumer();
+	void start(std::function<void(const PhysicsEvent&)> handler);
+	void stop();
+
+	unsigned long long dropped() const { return droppedCount.load(std::memory_order_relaxed); }
+	bool offer(const PhysicsEvent& event);
+
+private:
+	SpscRing<PhysicsEvent, 8192> ring;
+	std::atomic<unsigned long long> droppedCount{ 0 };
+	std::atomic<bool> running{ false };
+	std::thread thread;
+	std::function<void(const PhysicsEvent&)> handler;
+};
+
+// PhysX callback that fans records out to the consumers. Runs on the thread
+// calling fetchResults and never allocates, full rings drop events instead of stalling
+class EventStream : public physx::PxSimulationEventCallback {
+public:
+	static const unsigned int MaxConsumers = 8;
+
+	// register before the first simulate
+	bool addConsumer(EventConsumer& consumer);
+	void setFrame(unsigned int frame) { currentFrame = frame; }
+
+	void onContact(const physx::PxContactPairHeader& pairHeader, const physx::PxContactPair* pairs, physx::PxU32 nbPairs) override;
+	void onTrigger(physx::PxTriggerPair* pairs, physx::PxU32 count) override;
+	void onWake(physx::PxActor** actors, physx::PxU32 count) override;
+	void onSleep(physx::PxActor** actors, physx::PxU32 count) override;
+	void onConstraintBreak(physx::PxConstraintInfo*, physx::PxU32) override {}
+	void onAdvance(const physx::PxRigidBody* const*, const physx::PxTransform*, const physx::PxU32) override {}
+
+private:
+	EventConsumer* consumers[MaxConsumers] = {};
+	unsigned int consumerCount = 0;
+	unsigned int currentFrame = 0;
+
+	void publish(const PhysicsEvent& event);
+};
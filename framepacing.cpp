@@ -0,0 +1,98 @@
+#include "framepacing.h"
+#include <chrono>
+#include <thread>
+
+void FramePacer::init(GLFWwindow* window, PresentMode mode) {
+	presentMode = mode;
+	if (mode == PresentMode::Adaptive &&
+		!glfwExtensionSupported("WGL_EXT_swap_control_tear") && !glfwExtensionSupported("GLX_EXT_swap_control_tear")) {
+		presentMode = PresentMode::Vsync;
+	}
+
+	switch (presentMode) {
+	case PresentMode::Vsync: glfwSwapInterval(1); break;
+	case PresentMode::Adaptive: glfwSwapInterval(-1); break;
+	case PresentMode::Limiter: glfwSwapInterval(0); break;
+	}
+
+	float hz = limiterHz;
+	if (hz <= 0.0f) {
+		GLFWmonitor* monitor = glfwGetWindowMonitor(window) ? glfwGetWindowMonitor(window) : glfwGetPrimaryMonitor();
+		const GLFWvidmode* videoMode = monitor ? glfwGetVideoMode(monitor) : nullptr;
+		hz = videoMode && videoMode->refreshRate > 0 ? (float)videoMode->refreshRate : 60.0f;
+	}
+	frameTime = 1.0 / hz;
+	deadline = glfwGetTime();
+
+	glGenQueries(QueryCount, queries);
+}
+
+const char* FramePacer::modeName() const {
+	switch (presentMode) {
+	case PresentMode::Adaptive: return "adaptive";
+	case PresentMode::Limiter: return "limiter";
+	default: return "vsync";
+	}
+}
+
+void FramePacer::resetStats() {
+	latencySum = 0.0;
+	latencyCount = 0;
+	latencyMax = 0.0;
+}
+
+void FramePacer::collect(unsigned int slot, bool wait) {
+	if (!pending[slot]) return;
+	if (!wait) {
+		GLint available = 0;
+		glGetQueryObjectiv(queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) return;
+	}
+
+	GLuint64 finished = 0;
+	glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &finished);
+	pending[slot] = false;
+
+	double latency = ((GLint64)finished - sampleTimes[slot]) / 1.0e6;
+	latencySum += latency;
+	latencyCount++;
+	if (latency > latencyMax) latencyMax = latency;
+}
+
+void FramePacer::beginFrame() {
+	if (presentMode == PresentMode::Limiter) {
+		// sleep most of the way, spin the last bit, the scheduler is too coarse for the rest
+		double now = glfwGetTime();
+		double remaining = deadline - now;
+		if (remaining > 0.002) std::this_thread::sleep_for(std::chrono::duration<double>(remaining - 0.0015));
+		while (glfwGetTime() < deadline) {}
+
+		deadline += frameTime;
+		if (deadline < glfwGetTime()) deadline = glfwGetTime() + frameTime; // fell behind, don't try to catch up
+	}
+
+	// with the previous frame done the driver has nothing queued, so input read
+	// from here on shows up in the very next swap
+	if (previousFrame) {
+		glClientWaitSync(previousFrame, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000);
+		glDeleteSync(previousFrame);
+		previousFrame = nullptr;
+	}
+
+	for (unsigned int slot = 0; slot < QueryCount; slot++) collect(slot, false);
+}
+
+void FramePacer::inputSampled() {
+	glGetInteger64v(GL_TIMESTAMP, &currentSample);
+}
+
+void FramePacer::endFrame() {
+	unsigned int slot = frame % QueryCount;
+	collect(slot, true);
+
+	glQueryCounter(queries[slot], GL_TIMESTAMP);
+	sampleTimes[slot] = currentSample;
+	pending[slot] = true;
+	previousFrame = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	frame++;
+}
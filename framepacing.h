@@ -0,0 +1,53 @@
+#pragma once
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+enum class PresentMode : unsigned char {
+	Vsync,    // swap interval 1
+	Adaptive, // swap interval -1, tears instead of waiting a whole refresh when a frame is late
+	Limiter   // no vsync, the CPU sleeps to the frame rate before reading input
+};
+
+// keeps at most one frame in flight and measures the time from the last input
+// read of a frame to the GPU finishing it (the swap), with timestamp queries.
+// Its GL objects live as long as the context
+class FramePacer {
+public:
+	float limiterHz = 0.0f; // 0 follows the monitor refresh rate
+
+	// falls back to Vsync when adaptive sync isn't exposed by the driver
+	void init(GLFWwindow* window, PresentMode mode);
+	// waits for the frame budget and the previous frame, call before polling input
+	void beginFrame();
+	// the last input read that still affects this frame
+	void inputSampled();
+	// right after glfwSwapBuffers
+	void endFrame();
+
+	PresentMode mode() const { return presentMode; }
+	const char* modeName() const;
+	// since the last resetStats
+	float averageLatencyMs() const { return latencyCount ? (float)(latencySum / latencyCount) : 0.0f; }
+	float maxLatencyMs() const { return (float)latencyMax; }
+	void resetStats();
+
+private:
+	static const unsigned int QueryCount = 4;
+
+	PresentMode presentMode = PresentMode::Vsync;
+	GLuint queries[QueryCount] = {};
+	GLint64 sampleTimes[QueryCount] = {};
+	bool pending[QueryCount] = {};
+	unsigned int frame = 0;
+	GLsync previousFrame = nullptr;
+	GLint64 currentSample = 0;
+
+	double frameTime = 0.0;
+	double deadline = 0.0;
+
+	double latencySum = 0.0;
+	unsigned int latencyCount = 0;
+	double latencyMax = 0.0;
+
+	void collect(unsigned int slot, bool wait);
+};
@@ -0,0 +1,78 @@
+#include "jobs.h"
+#include "allocaudit.h"
+
+JobPool::JobPool(unsigned int workers) {
+	if (workers == 0) {
+		unsigned int hardware = std::thread::hardware_concurrency();
+		workers = hardware > 1 ? hardware - 1 : 1;
+	}
+	for (unsigned int i = 0; i < workers; i++) {
+		threads.emplace_back(&JobPool::worker, this);
+	}
+}
+
+JobPool::~JobPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto& thread : threads) thread.join();
+}
+
+void JobPool::runChunks() {
+	for (;;) {
+		size_t begin = next.fetch_add(taskGrain);
+		if (begin >= taskCount) break;
+		size_t end = begin + taskGrain < taskCount ? begin + taskGrain : taskCount;
+		(*task)(begin, end);
+	}
+}
+
+void JobPool::worker() {
+	// chunks run inside whatever phase the main loop is in
+	auditWatchThread();
+	unsigned int seen = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&]() { return stopping || generation != seen; });
+			if (stopping) return;
+			seen = generation;
+		}
+
+		runChunks();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--active == 0) finished.notify_one();
+	}
+}
+
+void JobPool::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+	if (count == 0) return;
+	if (grain == 0) grain = 1;
+
+	// not worth waking anyone for a single chunk
+	if (count <= grain || threads.empty()) {
+		fn(0, count);
+		return;
+	}
+
+	std::lock_guard<std::mutex> serial(dispatch);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		task = &fn;
+		taskCount = count;
+		taskGrain = grain;
+		next.store(0);
+		active = (unsigned int)threads.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	runChunks();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [&]() { return active == 0; });
+	task = nullptr;
+}
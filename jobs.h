@@ -0,0 +1,37 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fork/join pool for data parallel loops, the calling thread works too
+class JobPool {
+public:
+	explicit JobPool(unsigned int workers = 0); // 0 = one less than the hardware threads
+	~JobPool();
+
+	unsigned int threadCount() const { return (unsigned int)threads.size() + 1; }
+
+	// runs fn(begin, end) over [0, count) in chunks of grain, returns once every chunk is done
+	void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn);
+
+private:
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable finished;
+	std::mutex dispatch;
+
+	const std::function<void(size_t, size_t)>* task = nullptr;
+	size_t taskCount = 0;
+	size_t taskGrain = 1;
+	std::atomic<size_t> next{ 0 };
+	unsigned int generation = 0;
+	unsigned int active = 0;
+	bool stopping = false;
+
+	void worker();
+	void runChunks();
+};
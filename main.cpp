@@ -6,10 +6,30 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include "shader.h"
 #include "shader_code.h"
+#include "simlod.h"
+#include "objects.h"
+#include "staticbatch.h"
+#include "mesh.h"
+#include "renderqueue.h"
+#include "physics.h"
+#include "crowd.h"
+#include "events.h"
+#include "queries.h"
+#include "replication.h"
+#include "world.h"
+#include "framepacing.h"
+#include "scenarios.h"
+#include "shadow.h"
+#include "material.h"
+#include "allocaudit.h"
 #include <PxPhysicsAPI.h>
 #include <vector>
 #include <characterkinematic/PxControllerManager.h>
 #include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cwchar>
+#include <atomic>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
@@ -22,34 +42,10 @@
 
 using namespace physx;
 
-PxDefaultAllocator gAllocator;
-PxDefaultErrorCallback gErrorCallback;
-
-PxFoundation* gFoundation = nullptr;
-PxPhysics* gPhysics = nullptr;
-PxScene* gScene = nullptr;
-PxMaterial* gMaterial = nullptr;
-PxMaterial* gBallMaterial = nullptr;
-
-struct ObjectBuffer {
-	unsigned int VAO, VBO, EBO;
-};
-
 struct Rotation {
 	float yaw, pitch, roll;
 };
 
-struct Cube {
-	glm::vec3 Scale;
-	glm::vec3 Color;
-	PxRigidDynamic* pxRigidBody;
-};
-
-struct Light {
-	glm::vec3 pos;
-	glm::vec3 color;
-};
-
 Light worldLight;
 
 int Width = 800;
@@ -63,126 +59,10 @@ glm::mat4 projection, view;
 
 glm::vec3 cameraPos;
 
-int sphereIndices = 0;
-
-void generateSphere(float radius,
-	unsigned int sectorCount,
-	unsigned int stackCount,
-	std::vector<float>& vertices,
-	std::vector<unsigned int>& indices)
-{
-	const float PI = 3.14159265359f;
-
-	for (unsigned int i = 0; i <= stackCount; ++i)
-	{
-		float stackAngle = PI / 2 - i * PI / stackCount; // pi/2 -> -pi/2
-		float xy = radius * cosf(stackAngle);
-		float z = radius * sinf(stackAngle);
-
-		for (unsigned int j = 0; j <= sectorCount; ++j)
-		{
-			float sectorAngle = j * 2 * PI / sectorCount; // 0 -> 2pi
-
-			// position
-			float x = xy * cosf(sectorAngle);
-			float y = xy * sinf(sectorAngle);
-			vertices.push_back(x);
-			vertices.push_back(y);
-			vertices.push_back(z);
-
-			// normal (normalized)
-			float nx = x / radius;
-			float ny = y / radius;
-			float nz = z / radius;
-			vertices.push_back(nx);
-			vertices.push_back(ny);
-			vertices.push_back(nz);
-
-			// texture coords
-			float s = (float)j / sectorCount;
-			float t = (float)i / stackCount;
-			vertices.push_back(s);
-			vertices.push_back(t);
-		}
-	}
-
-	// indices
-	for (unsigned int i = 0; i < stackCount; ++i)
-	{
-		unsigned int k1 = i * (sectorCount + 1);
-		unsigned int k2 = k1 + sectorCount + 1;
-
-		for (unsigned int j = 0; j < sectorCount; ++j, ++k1, ++k2)
-		{
-			if (i != 0)
-			{
-				indices.push_back(k1);
-				indices.push_back(k2);
-				indices.push_back(k1 + 1);
-			}
-
-			if (i != (stackCount - 1))
-			{
-				indices.push_back(k1 + 1);
-				indices.push_back(k2);
-				indices.push_back(k2 + 1);
-			}
-		}
-	}
-}
-
-
 PxVec3 vec3ToPxVec3(glm::vec3 value) {
 	return PxVec3(value.x, value.y, value.z);
 }
 
-void initPhysX() {
-	gFoundation = PxCreateFoundation(PX_PHYSICS_VERSION, gAllocator, gErrorCallback);
-	gPhysics = PxCreatePhysics(PX_PHYSICS_VERSION, *gFoundation, PxTolerancesScale(), true, nullptr);
-
-	PxSceneDesc sceneDesc(gPhysics->getTolerancesScale());
-	sceneDesc.gravity = PxVec3(0.0f, -9.81f, 0.0f);
-	PxDefaultCpuDispatcher* dispatcher = PxDefaultCpuDispatcherCreate(2);
-	sceneDesc.cpuDispatcher = dispatcher;
-	sceneDesc.filterShader = PxDefaultSimulationFilterShader;
-
-	gScene = gPhysics->createScene(sceneDesc);
-
-	gMaterial = gPhysics->createMaterial(0.5f, 0.5f, 0.1f);
-	gBallMaterial = gPhysics->createMaterial(0.9f, 0.9f, 0.7f);
-
-	// create ground
-	PxRigidStatic* ground = PxCreatePlane(*gPhysics, PxPlane(0, 1, 0, 0), *gMaterial);
-	gScene->addActor(*ground);
-}
-
-PxRigidDynamic* createPxCube(const PxVec3& position, const PxVec3& halfExtents) {
-	PxBoxGeometry geometry(halfExtents);
-	PxTransform transform(position);
-	PxRigidDynamic* body = gPhysics->createRigidDynamic(transform);
-	PxShape* shape = gPhysics->createShape(geometry, *gMaterial);
-	body->attachShape(*shape);
-	PxRigidBodyExt::updateMassAndInertia(*body, 0.15f);
-	gScene->addActor(*body);
-	return body;
-}
-
-PxRigidDynamic* createPxSphere(const PxVec3& position, PxReal radius = 1.0f) {
-	PxSphereGeometry geometry(radius);          // radius = 1
-	PxTransform transform(position);            // position in world
-	PxRigidDynamic* body = gPhysics->createRigidDynamic(transform);
-
-	PxShape* shape = gPhysics->createShape(geometry, *gBallMaterial);
-	body->setLinearDamping(0.1f);
-	body->setAngularDamping(0.2f);
-	body->attachShape(*shape);
-
-	PxRigidBodyExt::updateMassAndInertia(*body, 7.5f);
-
-	gScene->addActor(*body);
-	return body;
-}
-
 float lastX = 400, lastY = 300; // center of screen initially
 float yaw = -90.0f; // initialize facing -Z
 float pitch = 0.0f;
@@ -192,7 +72,6 @@ glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
 float sensitivity = 0.5f;
 
 bool firstMouse = true;
-unsigned int ballTexture;
 
 const float ballRadius = 1.f;
 
@@ -233,155 +112,210 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 	glViewport(0, 0, width, height);
 }
 
-void InitCubeBuffer() {
-	glGenVertexArrays(1, &cubeBuffer.VAO);
-	glGenBuffers(1, &cubeBuffer.VBO);
-	glGenBuffers(1, &cubeBuffer.EBO);
-	
-	glBindVertexArray(cubeBuffer.VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, cubeBuffer.VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices, GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeBuffer.EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cube_indices), cube_indices, GL_STATIC_DRAW);
-
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);           // position
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float))); // normal
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float))); // texcoord
-	glEnableVertexAttribArray(2);
-	
+void AttachInstanceData(unsigned int VAO, unsigned int instanceVBO) {
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+	GLsizei vec4Size = sizeof(glm::vec4);
+	for (int i = 0; i < 4; i++) {
+		glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(i * vec4Size));
+		glEnableVertexAttribArray(3 + i);
+		glVertexAttribDivisor(3 + i, 1);
+	}
+	glVertexAttribIPointer(7, 1, GL_UNSIGNED_INT, sizeof(InstanceData), (void*)offsetof(InstanceData, material));
+	glEnableVertexAttribArray(7);
+	glVertexAttribDivisor(7, 1);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(0);
 }
 
-void InitSphereBuffer() {
-	std::vector<float> vertices;
-	std::vector<unsigned int> indices;
-	generateSphere(ballRadius, 10, 10, vertices, indices);
-
-	glGenVertexArrays(1, &sphereBuffer.VAO);
-	glGenBuffers(1, &sphereBuffer.VBO);
-	glGenBuffers(1, &sphereBuffer.EBO);
+void InitCubeBuffer() {
+	uploadMesh(cube_vertices, sizeof(cube_vertices) / (8 * sizeof(float)), cube_indices, sizeof(cube_indices) / sizeof(unsigned int), cubeBuffer);
+}
 
-	glBindVertexArray(sphereBuffer.VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, sphereBuffer.VBO);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereBuffer.EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+MeshLodChain sphereLods;
+std::vector<unsigned int> sphereInstanceVBOs;
+std::vector<size_t> sphereInstanceCapacity;
+std::vector<std::vector<InstanceData>> sphereInstances;
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);           // position
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float))); // normal
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float))); // texcoord
-	glEnableVertexAttribArray(2);
+void InitSphereBuffer() {
+	buildSphereLods(ballRadius, sphereLods);
+
+	size_t lodCount = sphereLods.lods.size();
+	sphereInstanceVBOs.resize(lodCount);
+	sphereInstanceCapacity.assign(lodCount, 0);
+	sphereInstances.resize(lodCount);
+	glGenBuffers((GLsizei)lodCount, sphereInstanceVBOs.data());
+	for (size_t i = 0; i < lodCount; i++) {
+		AttachInstanceData(sphereLods.lods[i].buffer.VAO, sphereInstanceVBOs[i]);
+	}
+}
 
-	glBindVertexArray(0);
+void InitPlaneBuffer() {
+	uploadMesh(plane_vertices, sizeof(plane_vertices) / (8 * sizeof(float)), plane_indices, sizeof(plane_indices) / sizeof(unsigned int), planeBuffer);
+}
 
-	sphereIndices = indices.size();
+// one texture array and tint table for every instanced body
+MaterialTable materials;
+std::vector<unsigned int> stackMaterials;
+std::vector<unsigned int> ballMaterials;
+unsigned int agentMaterial = 0;
+
+void InitMaterials() {
+	const char* layers[] = { "ball.png" };
+	materials.init(layers, 1);
+	const unsigned int ballLayer = 1;
+
+	stackMaterials.push_back(materials.find(glm::vec3(0.49f, 0.27f, 0.47f), MaterialTable::WhiteLayer));
+	stackMaterials.push_back(materials.find(glm::vec3(0.27f, 0.38f, 0.55f), MaterialTable::WhiteLayer));
+	stackMaterials.push_back(materials.find(glm::vec3(0.58f, 0.45f, 0.25f), MaterialTable::WhiteLayer));
+	stackMaterials.push_back(materials.find(glm::vec3(0.32f, 0.50f, 0.36f), MaterialTable::WhiteLayer));
+	ballMaterials.push_back(materials.find(glm::vec3(1.0f), ballLayer));
+	ballMaterials.push_back(materials.find(glm::vec3(1.0f, 0.45f, 0.45f), ballLayer));
+	ballMaterials.push_back(materials.find(glm::vec3(0.5f, 0.65f, 1.0f), ballLayer));
+	agentMaterial = materials.find(glm::vec3(0.2f, 0.6f, 0.3f), MaterialTable::WhiteLayer);
 }
 
-void InitPlaneBuffer() {
-	glGenVertexArrays(1, &planeBuffer.VAO);
-	glGenBuffers(1, &planeBuffer.VBO);
-	glGenBuffers(1, &planeBuffer.EBO);
+RenderQueue renderQueue;
 
-	glBindVertexArray(planeBuffer.VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, planeBuffer.VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(plane_vertices), plane_vertices, GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, planeBuffer.EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(plane_indices), plane_indices, GL_STATIC_DRAW);
+// moving bodies are collected while submitting, baked batches come from the static batcher
+ShadowMap shadowMap;
+std::vector<ShadowCaster> dynamicCasters;
+std::vector<ShadowCaster> staticCasters;
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);           // position
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float))); // normal
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float))); // texcoord
-	glEnableVertexAttribArray(2);
+// grows the buffer when needed and uploads the instance data
+void UploadInstances(unsigned int instanceVBO, size_t& capacity, const std::vector<InstanceData>& models) {
+	FramePhase phase = auditPhase(FramePhase::Upload);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+	if (models.size() > capacity) {
+		capacity = models.size() * 2;
+		glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(InstanceData), nullptr, GL_DYNAMIC_DRAW);
+	}
+	glBufferSubData(GL_ARRAY_BUFFER, 0, models.size() * sizeof(InstanceData), models.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	auditPhase(phase);
+}
 
-	glBindVertexArray(0);
+// sort depth of an instanced packet, the camera distance of its centroid
+float InstanceDepth(const std::vector<InstanceData>& instances) {
+	glm::vec3 centroid(0.0f);
+	for (auto& instance : instances) centroid += glm::vec3(instance.model[3]);
+	centroid /= (float)instances.size();
+	return glm::length(centroid - cameraPos);
 }
 
-void InitBallTexture() {
-	int w, h, c;
-	unsigned char* data = stbi_load("ball.png", &w, &h, &c, 4);
-	if (!data) {
-		MessageBoxA(NULL, "Failed to load texture for ball", "Error", MB_OK | MB_ICONWARNING);
-		return;
+void SubmitSphereModels(const std::vector<InstanceData>& models, Shader& shader) {
+	// pick a lod per sphere from its projected radius in pixels
+	float pixelsPerUnit = (Height * 0.5f) / tanf(glm::radians(45.0f) * 0.5f);
+	for (auto& instances : sphereInstances) instances.clear();
+	for (auto& model : models) {
+		float distance = glm::max(glm::length(glm::vec3(model.model[3]) - cameraPos), 0.1f);
+		int lod = sphereLods.select(ballRadius * pixelsPerUnit / distance);
+		sphereInstances[lod].push_back(model);
+	}
+
+	for (size_t i = 0; i < sphereInstances.size(); i++) {
+		const std::vector<InstanceData>& instances = sphereInstances[i];
+		if (instances.empty()) continue;
+		UploadInstances(sphereInstanceVBOs[i], sphereInstanceCapacity[i], instances);
+
+		const MeshLod& lod = sphereLods.lods[i];
+		DrawPacket packet = RenderQueue::packet(shader, lod.buffer.VAO, GL_UNSIGNED_SHORT, lod.indexCount);
+		packet.key = RenderQueue::makeKey(RenderLayer::Opaque, InstanceDepth(instances), shader.ID, lod.buffer.VAO, 0);
+		packet.instanceCount = (GLsizei)instances.size();
+		renderQueue.submit(packet);
+		dynamicCasters.push_back(ShadowCaster{ lod.buffer.VAO, GL_UNSIGNED_SHORT, lod.indexCount, (GLsizei)instances.size() });
 	}
+}
+
+std::vector<InstanceData> sphereModels;
 
-	glGenTextures(1, &ballTexture);
-	glBindTexture(GL_TEXTURE_2D, ballTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	glBindTexture(GL_TEXTURE_2D, 0);
+// any lod may end up holding every sphere, reserved when spheres are spawned so frames only refill
+void ReserveSphereInstances(size_t count) {
+	sphereModels.reserve(count);
+	for (auto& instances : sphereInstances) instances.reserve(count);
 }
 
-glm::mat4 GetCubeModel(const Cube& cube) {
-	glm::mat4 model(1.0f);
-	PxTransform pose = cube.pxRigidBody->getGlobalPose();
-	model = glm::translate(model, glm::vec3(pose.p.x,pose.p.y,pose.p.z));
-	glm::quat rot(pose.q.w, pose.q.x, pose.q.y, pose.q.z);
-	model *= glm::mat4_cast(rot);
-	model = glm::scale(model, cube.Scale);
-	return model;
+void ExtractSpheres(const std::vector<Cube>& spheres) {
+	sphereModels.clear();
+	for (auto& sphere : spheres) sphereModels.push_back(InstanceData{ GetCubeModel(sphere), sphere.Material });
 }
 
-void RenderCube(const Cube& cube, Shader& shader) {
-	glBindVertexArray(cubeBuffer.VAO);
-	shader.use();
+void SubmitSpheres(const std::vector<Cube>& spheres, Shader& shader) {
+	ExtractSpheres(spheres);
+	SubmitSphereModels(sphereModels, shader);
+}
 
-	glm::mat4 model = GetCubeModel(cube);
-	shader.setMat4("model", model);
-	shader.setMat4("projection", projection);
-	shader.setMat4("view", view);
+void SubmitPlane(Shader& shader) {
+	DrawPacket packet = RenderQueue::packet(shader, planeBuffer.VAO, GL_UNSIGNED_SHORT, 6);
+	packet.key = RenderQueue::makeKey(RenderLayer::Opaque, cameraPos.y, shader.ID, planeBuffer.VAO, 0);
+	packet.hasModel = true;
+	packet.model = glm::scale(glm::mat4(1.0f), glm::vec3(200.f, 1.f, 200.f));
+	packet.hasColor = true;
+	packet.color = glm::vec3(0.7f, 0.7f, 0.7f);
+	renderQueue.submit(packet);
+}
 
-	shader.setVec3("objectColor", cube.Color);
-	shader.setVec3("lightColor", worldLight.color);
-	shader.setVec3("lightPos", worldLight.pos);
-	shader.setVec3("viewPos", cameraPos);
+ObjectBuffer agentBuffer;
+GLsizei agentIndices = 0;
+unsigned int agentInstanceVBO;
+std::vector<InstanceData> agentModels;
 
-	glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
+void InitAgentBuffer(size_t count) {
+	std::vector<float> vertices;
+	std::vector<unsigned int> indices;
+	generateSphere(1.0f, 12, 8, vertices, indices);
+	agentIndices = uploadMesh(vertices.data(), (unsigned int)(vertices.size() / 8), indices.data(), (unsigned int)indices.size(), agentBuffer);
+
+	agentModels.reserve(count);
+	glGenBuffers(1, &agentInstanceVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, agentInstanceVBO);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(InstanceData), nullptr, GL_DYNAMIC_DRAW);
+	AttachInstanceData(agentBuffer.VAO, agentInstanceVBO);
 }
 
-void RenderSphere(const Cube& cube, Shader& shader) {
-	glBindVertexArray(sphereBuffer.VAO);
-	shader.use();
+// capsule instances for the frame, shared by the windowed loop and the headless audit
+void ExtractAgents(const Crowd& crowd) {
+	// ellipsoid stand-in for the capsule
+	glm::vec3 scale(crowd.settings.radius, crowd.settings.radius + crowd.settings.height * 0.5f, crowd.settings.radius);
+	agentModels.clear();
+	for (size_t i = 0; i < crowd.size(); i++) {
+		PxVec3 c = crowd.center(i);
+		glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(c.x, c.y, c.z));
+		agentModels.push_back(InstanceData{ glm::scale(model, scale), agentMaterial });
+	}
+}
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, ballTexture);
-	glm::mat4 model = GetCubeModel(cube);
-	shader.setMat4("model", model);
-	shader.setMat4("projection", projection);
-	shader.setMat4("view", view);
-	shader.setInt("texture", 0);
-	shader.setVec3("objectColor", cube.Color);
-	shader.setVec3("lightColor", worldLight.color);
-	shader.setVec3("lightPos", worldLight.pos);
-	shader.setVec3("viewPos", cameraPos);
-
-	glDrawElements(GL_TRIANGLES, sphereIndices, GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
+void SubmitAgents(const Crowd& crowd, Shader& shader) {
+	if (crowd.size() == 0) return;
+	ExtractAgents(crowd);
+
+	FramePhase phase = auditPhase(FramePhase::Upload);
+	glBindBuffer(GL_ARRAY_BUFFER, agentInstanceVBO);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, agentModels.size() * sizeof(InstanceData), agentModels.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	auditPhase(phase);
+
+	DrawPacket packet = RenderQueue::packet(shader, agentBuffer.VAO, GL_UNSIGNED_SHORT, agentIndices);
+	packet.key = RenderQueue::makeKey(RenderLayer::Opaque, InstanceDepth(agentModels), shader.ID, agentBuffer.VAO, 0);
+	packet.instanceCount = (GLsizei)agentModels.size();
+	renderQueue.submit(packet);
+	dynamicCasters.push_back(ShadowCaster{ agentBuffer.VAO, GL_UNSIGNED_SHORT, agentIndices, (GLsizei)agentModels.size() });
 }
 
-void RenderPlane(Shader& shader) {
-	glBindVertexArray(planeBuffer.VAO);
-	shader.use();
-	glm::mat4 model = glm::scale(glm::mat4(1.0f), glm::vec3(200.f, 1.f, 200.f));
-	shader.setMat4("model", model);
-	shader.setMat4("projection", projection);
-	shader.setMat4("view", view);
-	shader.setVec3("objectColor", glm::vec3(0.7f,0.7f,0.7f));
-	shader.setVec3("lightColor", worldLight.color);
-	shader.setVec3("lightPos", worldLight.pos);
-	shader.setVec3("viewPos", cameraPos);
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
+StaticBatcher staticBatcher;
+
+// cached layer only when the batches changed, then the casters collected this frame on top
+void RenderShadows(Shader& depthShader, Shader& instancedDepthShader) {
+	if (shadowMap.needsStatic()) {
+		staticCasters.clear();
+		staticBatcher.collectCasters(staticCasters);
+		shadowMap.renderStatic(depthShader, instancedDepthShader, staticCasters);
+	}
+	shadowMap.renderDynamic(depthShader, instancedDepthShader, dynamicCasters, Width, Height);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, shadowMap.texture());
+	glActiveTexture(GL_TEXTURE0);
 }
 
 unsigned int textureID;
@@ -428,7 +362,294 @@ void initSkybox() {
 	glBindVertexArray(0);
 }
 
+void SubmitSkybox(Shader& shader) {
+	DrawPacket packet = RenderQueue::packet(shader, skyboxVAO, 0, 36);
+	packet.key = RenderQueue::makeKey(RenderLayer::Sky, 0.0f, shader.ID, skyboxVAO, textureID);
+	packet.textureTarget = GL_TEXTURE_CUBE_MAP;
+	packet.texture = textureID;
+	packet.depthFunc = GL_LEQUAL; // pass depth test when depth == 1.0
+	packet.hasView = true;
+	packet.view = glm::mat4(glm::mat3(view));
+	renderQueue.submit(packet);
+}
+
+// --server has no window: it reports to a console, and Ctrl+C or closing that console stops it
+static std::atomic<bool> serverStop(false);
+static std::atomic<bool> serverStopped(false);
+
+static BOOL WINAPI ServerControlHandler(DWORD) {
+	serverStop = true;
+	// after a close event the process ends as soon as this returns, so wait for the cleanup
+	while (!serverStopped) Sleep(10);
+	return TRUE;
+}
+
+int RunServer() {
+	if (!AttachConsole(ATTACH_PARENT_PROCESS)) AllocConsole();
+	FILE* console = nullptr;
+	freopen_s(&console, "CONOUT$", "w", stdout);
+	freopen_s(&console, "CONOUT$", "w", stderr);
+	SetConsoleCtrlHandler(ServerControlHandler, TRUE);
+
+	printf("replication server on port %u, Ctrl+C to stop\n", DefaultReplicationPort);
+	int result = runReplicationServer(DefaultReplicationPort, serverStop);
+	printf("replication server stopped\n");
+	serverStopped = true;
+	return result;
+}
+
+// headless benchmark modes write their report to bench_output.txt
+int RunBenchmark(void (*benchmark)(FILE*)) {
+	FILE* out = nullptr;
+	if (fopen_s(&out, "bench_output.txt", "w") != 0 || !out) return -3;
+	initPhysX();
+	benchmark(out);
+	fclose(out);
+	return 0;
+}
+
+#ifdef ALLOCATION_AUDIT
+void WriteAuditSummary(FILE* log, const AllocationAudit& audit) {
+	for (unsigned int p = 0; p < (unsigned int)FramePhase::Count; p++) {
+		const PhaseAllocations& total = audit.total((FramePhase)p);
+		fprintf(log, "%-10s %10llu allocations %12llu bytes %10llu frees\n",
+			framePhaseName((FramePhase)p), total.allocations, total.bytes, total.frees);
+	}
+	fprintf(log, "%u frame(s) allocated outside spawn after the warmup\n", audit.failedFrames());
+}
+#endif
+
+// --audit-frames=<n>: the simulate, spawn and extraction parts of the frame loop for a fixed
+// number of frames without a window, so the zero allocation rule can be checked unattended.
+// Upload and draw need a GL context and are only covered by the windowed loop
+int RunAllocationAudit(unsigned int frames) {
+	FILE* log = nullptr;
+	if (fopen_s(&log, "alloc_audit.txt", "w") != 0 || !log) return -3;
+#ifndef ALLOCATION_AUDIT
+	(void)frames;
+	fprintf(log, "built without ALLOCATION_AUDIT, nothing was counted\n");
+	fclose(log);
+	return -6;
+#else
+	initPhysX();
+
+	// the demo stack, crowd and impact counter of the windowed loop
+	std::vector<Cube> cubes;
+	std::vector<Cube> spheres;
+	std::vector<InstanceData> cubeModels;
+	SimLod simLod;
+	std::vector<PxVec3> focusPoints;
+	for (int k = 0; k < 10; k++) {
+		for (int i = 0; i < 10; i++) {
+			for (int j = 0; j < 10; j++) {
+				Cube cube;
+				cube.Scale = glm::vec3(1.0f);
+				cube.Material = 0; // no material table without GL
+				cube.pxRigidBody = createPxCube(vec3ToPxVec3(glm::vec3(i * 1.f, 0.1f + k * 1.05f, 0.f + j * 1.f)), PxVec3(0.5f, 0.5f, 0.5f));
+				cubes.push_back(cube);
+				simLod.add(cube.pxRigidBody);
+			}
+		}
+	}
+
+	JobPool jobs;
+	Crowd crowd(*gPhysics, *gScene, *gMaterial, jobs);
+	for (int i = 0; i < 200; i++) {
+		crowd.add(PxVec3(-15.0f + (i % 20) * 1.5f, 0.0f, -15.0f + (i / 20) * 1.5f));
+	}
+	agentModels.reserve(crowd.size());
+	cubeModels.reserve(cubes.size());
+	focusPoints.reserve(1);
+
+	EventStream events;
+	EventConsumer impactCounter;
+	std::atomic<unsigned int> impacts(0);
+	impactCounter.filter.types = 1u << (unsigned int)PhysicsEventType::Contact;
+	impactCounter.filter.kinds = BodyKindSphere;
+	impactCounter.filter.minImpulse = 5.0f;
+	impactCounter.start([&impacts](const PhysicsEvent&) { impacts.fetch_add(1, std::memory_order_relaxed); });
+	events.addConsumer(impactCounter);
+	gScene->setSimulationEventCallback(&events);
+
+	AllocationAudit audit;
+	auditWatchThread();
+
+	const PxReal timeStep = 1.0f / 60.0f;
+	const PxVec3 player(3.0f, 0.0f, 20.0f);
+	for (unsigned int frame = 0; frame < frames; frame++) {
+		auditPhase(FramePhase::Other);
+
+		// a sphere thrown at the stack every two seconds, like the left click
+		if (frame % 120 == 0) {
+			auditPhase(FramePhase::Spawn);
+			Cube sphere;
+			sphere.pxRigidBody = createPxSphere(PxVec3(4.5f, 5.0f, 18.0f), ballRadius);
+			sphere.Scale = glm::vec3(1.0f);
+			sphere.Material = 0;
+			sphere.pxRigidBody->setLinearVelocity(PxVec3(0.0f, 0.0f, -25.0f));
+			spheres.push_back(sphere);
+			sphereModels.reserve(spheres.size());
+			focusPoints.reserve(spheres.size() + 1);
+		}
+
+		auditPhase(FramePhase::Simulate);
+		focusPoints.clear();
+		focusPoints.push_back(player);
+		for (auto& sphere : spheres) {
+			if (!sphere.pxRigidBody->isSleeping()) focusPoints.push_back(sphere.pxRigidBody->getGlobalPose().p);
+		}
+		simLod.update(focusPoints.data(), (unsigned int)focusPoints.size());
+		crowd.setObstacle(player, 0.4f);
+		crowd.step(timeStep);
+		events.setFrame(frame);
+		gScene->simulate(timeStep);
+		gScene->fetchResults(true);
+
+		auditPhase(FramePhase::Extraction);
+		cubeModels.clear();
+		for (auto& cube : cubes) cubeModels.push_back(InstanceData{ GetCubeModel(cube), cube.Material });
+		ExtractSpheres(spheres);
+		ExtractAgents(crowd);
+
+		auditPhase(FramePhase::Other);
+		audit.endFrame(log);
+	}
+
+	impactCounter.stop();
+	gScene->setSimulationEventCallback(nullptr);
+
+	if (frames <= audit.warmupFrames) fprintf(log, "%u frame(s) do not get past the %u frame warmup\n", frames, audit.warmupFrames);
+	WriteAuditSummary(log, audit);
+	fclose(log);
+	return audit.failedFrames() > 0 ? -6 : 0;
+#endif
+}
+
+glm::mat4 GetBodyModel(const BodyState& body) {
+	glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(body.position.x, body.position.y, body.position.z));
+	return model * glm::mat4_cast(glm::quat(body.rotation.w, body.rotation.x, body.rotation.y, body.rotation.z));
+}
+
+// watches a --server instance, no local simulation: bodies come from interpolated snapshots
+int RunClient(GLFWwindow* window, const NetAddress& server, Shader& materialShader, Shader& genericShader, Shader& skyboxShader,
+	Shader& shadowShader, Shader& shadowInstancedShader) {
+	ReplicationClient client;
+	if (!client.connect(server)) return -5;
+
+	unsigned int cubeInstanceVBO;
+	size_t cubeInstanceCapacity = 0;
+	glGenBuffers(1, &cubeInstanceVBO);
+	AttachInstanceData(cubeBuffer.VAO, cubeInstanceVBO);
+
+	std::vector<BodyState> bodies;
+	std::vector<InstanceData> cubeModels;
+	cameraPos = glm::vec3(4.5f, 5.0f, 30.0f);
+	projection = glm::perspective(glm::radians(45.0f), (float)Width / (float)Height, 0.1f, 100.f);
+	float oldTime = 0.0f, statsTime = 0.0f;
+	const float speed = 6.0f;
+
+	while (!glfwWindowShouldClose(window)) {
+		float currentTime = (float)glfwGetTime();
+		float deltaTime = currentTime - oldTime;
+		oldTime = currentTime;
+
+		client.poll(currentTime);
+		client.sample(currentTime, bodies);
+
+		glm::vec3 right = glm::normalize(glm::cross(cameraFront, cameraUp));
+		if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) cameraPos += cameraFront * speed * deltaTime;
+		if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) cameraPos -= cameraFront * speed * deltaTime;
+		if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) cameraPos -= right * speed * deltaTime;
+		if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) cameraPos += right * speed * deltaTime;
+		view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+
+		glClearColor(0.0f, 0.0f, 0.3f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		// nothing is baked on the client, every body is a dynamic caster
+		shadowMap.update(cameraPos, 0);
+		dynamicCasters.clear();
+
+		FrameUniforms frame;
+		frame.projection = projection;
+		frame.view = view;
+		frame.lightColor = worldLight.color;
+		frame.lightPos = worldLight.pos;
+		frame.viewPos = cameraPos;
+		frame.lightSpace = shadowMap.lightSpace();
+		renderQueue.begin(frame);
+
+		cubeModels.clear();
+		sphereModels.clear();
+		for (const BodyState& body : bodies) {
+			// snapshots carry no material, the kind picks the first look of each
+			if (body.kind == BodyKindSphere) sphereModels.push_back(InstanceData{ GetBodyModel(body), ballMaterials[0] });
+			else cubeModels.push_back(InstanceData{ GetBodyModel(body), stackMaterials[0] });
+		}
+
+		SubmitPlane(genericShader);
+		if (!cubeModels.empty()) {
+			UploadInstances(cubeInstanceVBO, cubeInstanceCapacity, cubeModels);
+			DrawPacket packet = RenderQueue::packet(materialShader, cubeBuffer.VAO, GL_UNSIGNED_SHORT, 36);
+			packet.key = RenderQueue::makeKey(RenderLayer::Opaque, InstanceDepth(cubeModels), materialShader.ID, cubeBuffer.VAO, 0);
+			packet.instanceCount = (GLsizei)cubeModels.size();
+			renderQueue.submit(packet);
+			dynamicCasters.push_back(ShadowCaster{ cubeBuffer.VAO, GL_UNSIGNED_SHORT, 36, (GLsizei)cubeModels.size() });
+		}
+		SubmitSphereModels(sphereModels, materialShader);
+		SubmitSkybox(skyboxShader);
+		materials.apply(materialShader);
+		RenderShadows(shadowShader, shadowInstancedShader);
+		renderQueue.flush();
+
+		if (currentTime - statsTime >= 1.0f) {
+			statsTime = currentTime;
+			char title[128];
+			snprintf(title, sizeof(title), "PhysX client | bodies %zu | snapshot %zu bytes", bodies.size(), client.lastSnapshotBytes());
+			glfwSetWindowTitle(window, title);
+		}
+
+		glfwPollEvents();
+		glfwSwapBuffers(window);
+	}
+
+	glfwTerminate();
+	netShutdown();
+	return 0;
+}
+
+// scenario regression run against bench_baselines.txt, the exit code is the number of regressions
+int RunScenarioSuite(bool updateBaselines) {
+	FILE* out = nullptr;
+	if (fopen_s(&out, "bench_output.txt", "w") != 0 || !out) return -3;
+	initPhysX();
+	int regressions = runScenarioSuite(out, "bench_baselines.txt", updateBaselines);
+	fclose(out);
+	return regressions;
+}
+
 int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine, int nCmdShow) {
+	if (wcsstr(pCmdLine, L"--bench-crowd")) return RunBenchmark(runCrowdBenchmark);
+	if (wcsstr(pCmdLine, L"--bench-queries")) return RunBenchmark(runQueryBenchmark);
+	if (wcsstr(pCmdLine, L"--bench-net")) return RunBenchmark(runReplicationBenchmark);
+	if (const wchar_t* auditFrames = wcsstr(pCmdLine, L"--audit-frames=")) return RunAllocationAudit((unsigned int)wcstol(auditFrames + 15, nullptr, 10));
+	if (wcsstr(pCmdLine, L"--bench-scenarios")) return RunScenarioSuite(wcsstr(pCmdLine, L"--update-baselines") != nullptr);
+	if (wcsstr(pCmdLine, L"--server")) return RunServer();
+	if (wcsstr(pCmdLine, L"--generate-world")) return generateWorld("world.bin", WorldGenSettings()) ? 0 : -3;
+
+	// --client connects to localhost, --client=<ip> anywhere else
+	NetAddress serverAddress;
+	const wchar_t* clientArg = wcsstr(pCmdLine, L"--client");
+	if (clientArg) {
+		char host[64] = "127.0.0.1";
+		if (clientArg[8] == L'=') {
+			size_t n = 0;
+			for (const wchar_t* c = clientArg + 9; *c && *c != L' ' && n < sizeof(host) - 1; c++) host[n++] = (char)*c;
+			host[n] = 0;
+		}
+		if (!netStartup() || !parseAddress(host, DefaultReplicationPort, serverAddress)) return -5;
+	}
+
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -440,7 +661,6 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 	}
 
 	glfwMakeContextCurrent(window);
-	glfwSwapInterval(1);
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 	glfwSetCursorPosCallback(window, mouse_callback);
@@ -449,10 +669,21 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 		return -2;
 	}
 
-	Shader shader(vertexShaderSource_sphere, fragmentShaderSource_sphere);
-	Shader cubeShader(vertexShaderSource_cube, fragmentShaderSource_cube);
+	// --frame-mode=vsync|adaptive|limiter, --fps=<n> sets the limiter rate
+	FramePacer pacer;
+	PresentMode presentMode = PresentMode::Vsync;
+	if (wcsstr(pCmdLine, L"--frame-mode=adaptive")) presentMode = PresentMode::Adaptive;
+	if (wcsstr(pCmdLine, L"--frame-mode=limiter")) presentMode = PresentMode::Limiter;
+	if (const wchar_t* fps = wcsstr(pCmdLine, L"--fps=")) pacer.limiterHz = (float)wcstol(fps + 6, nullptr, 10);
+	pacer.init(window, presentMode);
+
+	// all programs compile concurrently, first use() waits for the link
+	Shader materialShader(vertexShaderSource_material_instanced, fragmentShaderSource_material);
+	Shader batchShader(vertexShaderSource_material_batch, fragmentShaderSource_material);
 	Shader genericShader(vertexShaderSource_generic, fragmentShaderSource_generic);
 	Shader skyboxShader(vertexShaderSource_skybox, fragmentShaderSource_skybox);
+	Shader shadowShader(vertexShaderSource_shadow, fragmentShaderSource_shadow);
+	Shader shadowInstancedShader(vertexShaderSource_shadow_instanced, fragmentShaderSource_shadow);
 
 	initPhysX();
 
@@ -461,12 +692,15 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 
 	worldLight.color = glm::vec3(1.0f);
 	worldLight.pos = glm::vec3(12.0f, 10.0f, 20.0f);
+	// aimed at the middle of the demo stack
+	shadowMap.init(glm::vec3(4.5f, 0.0f, 4.5f) - worldLight.pos);
 
 	stbi_set_flip_vertically_on_load(true);
 	InitCubeBuffer();
+	staticBatcher.init(cube_vertices, sizeof(cube_vertices) / (8 * sizeof(float)), cube_indices, sizeof(cube_indices) / sizeof(unsigned int));
 	InitSphereBuffer();
 	InitPlaneBuffer();
-	InitBallTexture();
+	InitMaterials();
 	initSkybox();
 	std::vector<const char*> faces;
 	faces.push_back("right.jpg");
@@ -478,34 +712,61 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 	stbi_set_flip_vertically_on_load(false);
 	loadCubemap(faces);
 
+	// the setup above ran while the driver compiled, whatever is still compiling is
+	// waited out here with the window responsive rather than inside the first use()
+	Shader* programs[] = { &materialShader, &batchShader, &genericShader, &skyboxShader, &shadowShader, &shadowInstancedShader };
+	for (;;) {
+		bool allReady = true;
+		for (Shader* program : programs) allReady &= program->ready();
+		if (allReady || glfwWindowShouldClose(window)) break;
+		glfwPollEvents();
+		glClearColor(0.0f, 0.0f, 0.3f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glfwSwapBuffers(window);
+	}
+
+	if (clientArg) return RunClient(window, serverAddress, materialShader, genericShader, skyboxShader, shadowShader, shadowInstancedShader);
+
 	std::vector<Cube> cubes;
 	std::vector<Cube> spheres;
-	std::vector<glm::mat4> cubeModels;
-
-	for (int k = 0; k < 10; k++) {
+	std::vector<InstanceData> cubeModels;
+	SimLod simLod;
+	std::vector<PxVec3> focusPoints;
+
+	// a generated world.bin is streamed in chunks around the player, otherwise the fixed stack is built
+	WorldStreamer worldStreamer;
+	bool streaming = worldStreamer.open("world.bin");
+	for (int k = 0; k < 10 && !streaming; k++) {
 		for (int i = 0; i < 10; i++) {
 			for (int j = 0; j < 10; j++) {
 				Cube cube;
 				cube.Scale = glm::vec3(1.0f);
-				cube.Color = glm::vec3(0.49f, 0.27f, 0.47f);
+				cube.Material = stackMaterials[(i + j + k) % stackMaterials.size()];
 				cube.pxRigidBody = createPxCube(vec3ToPxVec3(glm::vec3(i * 1.f, 0.1f + k * 1.05f, 0.f + j * 1.f)), PxVec3(0.5f, 0.5f, 0.5f));
 				cubes.push_back(cube);
+				simLod.add(cube.pxRigidBody);
 			}
 		}
 	}
 
-	glBindVertexArray(cubeBuffer.VAO);
+	// npc capsules wandering through the pile
+	JobPool jobs;
+	Crowd crowd(*gPhysics, *gScene, *gMaterial, jobs);
+	for (int i = 0; i < 200; i++) {
+		crowd.add(PxVec3(-15.0f + (i % 20) * 1.5f, 0.0f, -15.0f + (i / 20) * 1.5f));
+	}
+	InitAgentBuffer(crowd.size());
+
+	// per frame containers start at their working size, spawning grows them again
+	cubeModels.reserve(cubes.size());
+	focusPoints.reserve(1);
+	dynamicCasters.reserve(sphereLods.lods.size() + 2);
+	renderQueue.reserve(sphereLods.lods.size() + 4); // plane, cubes, agents, sky, grown with the batches
+
 	unsigned int instanceVBO;
+	size_t instanceCapacity = 0;
 	glGenBuffers(1, &instanceVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * cubes.size(), cubeModels.data(), GL_DYNAMIC_DRAW);
-	GLsizei vec4Size = sizeof(glm::vec4);
-	for (int i = 0; i < 4; i++) {
-		glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * vec4Size));
-		glEnableVertexAttribArray(3 + i);
-		glVertexAttribDivisor(3 + i, 1);
-	}
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	AttachInstanceData(cubeBuffer.VAO, instanceVBO);
 	glBindVertexArray(cubeBuffer.VAO);
 
 	// init player
@@ -525,88 +786,93 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 
 	PxController* controller = controllerManager->createController(cDesc);
 
+	// sphere impacts counted on their own thread from the contact event stream
+	EventStream events;
+	EventConsumer impactCounter;
+	std::atomic<unsigned int> impacts(0);
+	impactCounter.filter.types = 1u << (unsigned int)PhysicsEventType::Contact;
+	impactCounter.filter.kinds = BodyKindSphere;
+	impactCounter.filter.minImpulse = 5.0f;
+	impactCounter.start([&impacts](const PhysicsEvent&) { impacts.fetch_add(1, std::memory_order_relaxed); });
+	events.addConsumer(impactCounter);
+	gScene->setSimulationEventCallback(&events);
+	unsigned int frameIndex = 0;
+
+	SceneQueryBatch queries(*gScene, jobs);
+
+#ifdef ALLOCATION_AUDIT
+	// every frame after the warmup that allocates outside spawn is logged and fails the run
+	AllocationAudit allocationAudit;
+	FILE* auditLog = nullptr;
+	fopen_s(&auditLog, "alloc_audit.txt", "w");
+#endif
+	auditWatchThread();
+
 	const PxReal timeStep = 1.0f / 60.0f;
+	unsigned int batchesReserved = 0;
 	bool wasPressed = false;
+	bool wasRightPressed = false;
 
 	float deltaTime = 0.0f, oldTime = 0.0f;
+	float statsTime = 0.0f;
 	const float speed = 3.0f;
 	const float distance = 2.0f; // distance of spawn
 
 	while (!glfwWindowShouldClose(window)) {
+		// input is read after the wait for the previous frame, not before it
+		pacer.beginFrame();
+		auditPhase(FramePhase::Other);
+		glfwPollEvents();
+
 		float currentTime = glfwGetTime();
 		deltaTime = currentTime - oldTime;
 		oldTime = currentTime;
 
-		glClearColor(0.0f, 0.0f, 0.3f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		gScene->simulate(timeStep);
-		gScene->fetchResults(true);
-
-		cameraPos.y = 3.0f;
-		view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-
-		// render skybox
-		glDepthFunc(GL_LEQUAL);  // pass depth test when depth == 1.0
-		skyboxShader.use();
-		glm::mat4 viewNoTranslation = glm::mat4(glm::mat3(view));
-		skyboxShader.setMat4("view", viewNoTranslation);
-		skyboxShader.setMat4("projection", projection);
-
-		// skybox cube
-		glBindVertexArray(skyboxVAO);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-		glBindVertexArray(0);
-		glDepthFunc(GL_LESS); // restore default
-
-		RenderPlane(genericShader);
-		
-		cubeModels.clear();
-		for (auto& cube : cubes) {
-			/*RenderCube(cube, shader);*/
-			glm::mat4 cubeModel = GetCubeModel(cube);
-			cubeModels.push_back(cubeModel);
-		}
-		glBindVertexArray(cubeBuffer.VAO);
-		glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, cubeModels.size() * sizeof(glm::mat4), cubeModels.data());
-		cubeShader.use();
-		cubeShader.setMat4("projection", projection);
-		cubeShader.setMat4("view", view);
-		cubeShader.setVec3("lightColor", worldLight.color);
-		cubeShader.setVec3("lightPos", worldLight.pos);
-		cubeShader.setVec3("viewPos", cameraPos);
-		cubeShader.setVec3("objectColor", glm::vec3(0.49f, 0.27f, 0.47f));
-		glDrawElementsInstanced(
-			GL_TRIANGLES,
-			36,
-			GL_UNSIGNED_INT,
-			0,
-			cubes.size()
-		);
-
-		for (auto& sphere : spheres) {
-			RenderSphere(sphere, shader);
-		}
-
 		if (glfwGetMouseButton(window,GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
 			if (!wasPressed) {
 				wasPressed = true;
+				FramePhase phase = auditPhase(FramePhase::Spawn);
 
 				glm::vec3 spawnPosition = cameraPos + cameraFront * distance;
 				Cube sphere;
 				sphere.pxRigidBody = createPxSphere(vec3ToPxVec3(spawnPosition), ballRadius);
-				sphere.Color = glm::vec3(1.0f, 0.0f, 0.0f);
+				sphere.Material = ballMaterials[spheres.size() % ballMaterials.size()];
 				sphere.Scale = glm::vec3(1.0f);
 				sphere.pxRigidBody->setLinearVelocity(vec3ToPxVec3(cameraFront * 25.0f));
 				spheres.push_back(sphere);
+				ReserveSphereInstances(spheres.size());
+				focusPoints.reserve(spheres.size() + 1);
+				auditPhase(phase);
 			}
 		}
 		else {
 			wasPressed = false;
 		}
 
+		// poke whatever is under the crosshair
+		if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS) {
+			if (!wasRightPressed) {
+				wasRightPressed = true;
+
+				RayQuery ray;
+				ray.origin = vec3ToPxVec3(cameraPos);
+				ray.direction = vec3ToPxVec3(cameraFront);
+				ray.maxDistance = 100.0f;
+				QueryHit hit;
+				queries.raycasts(&ray, &hit, 1);
+
+				// frozen bodies are kinematic until thawed, a push has to reach them too
+				PxRigidDynamic* body = hit.hit ? hit.actor->is<PxRigidDynamic>() : nullptr;
+				if (body) simLod.thaw(body);
+				if (body && !(body->getRigidBodyFlags() & PxRigidBodyFlag::eKINEMATIC)) {
+					PxRigidBodyExt::addForceAtPos(*body, ray.direction * 5.0f, hit.position, PxForceMode::eIMPULSE);
+				}
+			}
+		}
+		else {
+			wasRightPressed = false;
+		}
+
 		// update player
 		glm::vec3 moveDir(0.0f);
 		if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) moveDir += cameraFront;
@@ -614,7 +880,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 		if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) moveDir -= glm::normalize(glm::cross(cameraFront, cameraUp));
 		if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) moveDir += glm::normalize(glm::cross(cameraFront, cameraUp));
 
-		moveDir = glm::normalize(moveDir);
+		if (glm::length(moveDir) > 0.0f) moveDir = glm::normalize(moveDir);
 
 		PxVec3 disp(moveDir.x* speed* deltaTime,
 			-9.81f * deltaTime,
@@ -622,16 +888,145 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 
 		controller->move(disp, 0.01f, deltaTime, PxControllerFilters());
 
+		// player and moving projectiles keep the bodies around them at full rate
+		PxExtendedVec3 footPos = controller->getFootPosition();
+		focusPoints.clear();
+		focusPoints.push_back(PxVec3((float)footPos.x, (float)footPos.y, (float)footPos.z));
+		for (auto& sphere : spheres) {
+			if (!sphere.pxRigidBody->isSleeping()) focusPoints.push_back(sphere.pxRigidBody->getGlobalPose().p);
+		}
+
+		// the streamer and the batcher charge their own restructuring to spawn, their
+		// per frame scans stay in simulate and must not allocate
+		auditPhase(FramePhase::Simulate);
+		if (streaming) {
+			worldStreamer.update(focusPoints[0], cubes, materials);
+			if (!worldStreamer.removedSlots().empty() || !worldStreamer.insertedSlots().empty()) {
+				FramePhase phase = auditPhase(FramePhase::Spawn);
+				for (size_t slot : worldStreamer.removedSlots()) {
+					simLod.set(slot, nullptr);
+					staticBatcher.remove(slot);
+				}
+				for (size_t slot : worldStreamer.insertedSlots()) simLod.set(slot, cubes[slot].pxRigidBody);
+				cubeModels.reserve(cubes.size());
+				auditPhase(phase);
+			}
+		}
+
+		simLod.update(focusPoints.data(), (unsigned int)focusPoints.size());
+
+		crowd.setObstacle(focusPoints[0], cDesc.radius);
+		crowd.step(timeStep);
+
+		events.setFrame(frameIndex++);
+		gScene->simulate(timeStep);
+		gScene->fetchResults(true);
+
+		// settled bodies move into merged static geometry, woken ones come back out
+		staticBatcher.update(cubes);
+		if (staticBatcher.batchCount() > batchesReserved) {
+			FramePhase phase = auditPhase(FramePhase::Spawn);
+			batchesReserved = staticBatcher.batchCount();
+			staticCasters.reserve(batchesReserved);
+			renderQueue.reserve(batchesReserved + sphereLods.lods.size() + 4); // plane, cubes, agents, sky
+			auditPhase(phase);
+		}
+
+		auditPhase(FramePhase::Extraction);
+
+		// mouse look that arrived during the step still makes this frame
+		glfwPollEvents();
+		pacer.inputSampled();
 		PxExtendedVec3 pos = controller->getPosition();
 		cameraPos = glm::vec3((float)pos.x,
 			(float)pos.y + 1.5f,   // eye height
 			(float)pos.z);
 		view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-	
-		glfwPollEvents();
+
+		glClearColor(0.0f, 0.0f, 0.3f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		shadowMap.update(cameraPos, staticBatcher.revision());
+		dynamicCasters.clear();
+
+		FrameUniforms frame;
+		frame.projection = projection;
+		frame.view = view;
+		frame.lightColor = worldLight.color;
+		frame.lightPos = worldLight.pos;
+		frame.viewPos = cameraPos;
+		frame.lightSpace = shadowMap.lightSpace();
+		renderQueue.begin(frame);
+
+		SubmitPlane(genericShader);
+		staticBatcher.submit(renderQueue, batchShader, cameraPos);
+		
+		cubeModels.clear();
+		glm::vec3 cubeCenter(0.0f);
+		for (size_t i = 0; i < cubes.size(); i++) {
+			if (!cubes[i].pxRigidBody || staticBatcher.isBatched(i)) continue;
+			glm::mat4 cubeModel = GetCubeModel(cubes[i]);
+			cubeModels.push_back(InstanceData{ cubeModel, cubes[i].Material });
+			cubeCenter += glm::vec3(cubeModel[3]);
+		}
+		if (!cubeModels.empty()) {
+			UploadInstances(instanceVBO, instanceCapacity, cubeModels);
+
+			cubeCenter /= (float)cubeModels.size();
+			DrawPacket packet = RenderQueue::packet(materialShader, cubeBuffer.VAO, GL_UNSIGNED_SHORT, 36);
+			packet.key = RenderQueue::makeKey(RenderLayer::Opaque, glm::length(cubeCenter - cameraPos), materialShader.ID, cubeBuffer.VAO, 0);
+			packet.instanceCount = (GLsizei)cubeModels.size();
+			renderQueue.submit(packet);
+			dynamicCasters.push_back(ShadowCaster{ cubeBuffer.VAO, GL_UNSIGNED_SHORT, 36, (GLsizei)cubeModels.size() });
+		}
+
+		SubmitSpheres(spheres, materialShader);
+		SubmitAgents(crowd, materialShader);
+		SubmitSkybox(skyboxShader);
+
+		// streamed chunks may have added materials this frame
+		auditPhase(FramePhase::Upload);
+		materials.apply(materialShader);
+		materials.apply(batchShader);
+		RenderShadows(shadowShader, shadowInstancedShader);
+		renderQueue.flush();
+
+		// draw calls, state changes, input latency and shadow pass GPU time, refreshed once a second
+		if (currentTime - statsTime >= 1.0f) {
+			statsTime = currentTime;
+			const RenderStats& stats = renderQueue.stats();
+			ShadowTimings shadowTimes = shadowMap.timings();
+			char title[256];
+			snprintf(title, sizeof(title), "PhysX | draws %u | state changes %u | impacts %u/s | %s latency %.1f ms (max %.1f)"
+				" | shadows static %.2f ms x%u, blit %.2f ms, dynamic %.2f ms",
+				stats.drawCalls, stats.stateChanges(), impacts.exchange(0),
+				pacer.modeName(), pacer.averageLatencyMs(), pacer.maxLatencyMs(),
+				shadowTimes.staticMs, shadowTimes.staticRedraws, shadowTimes.blitMs, shadowTimes.dynamicMs);
+			glfwSetWindowTitle(window, title);
+			pacer.resetStats();
+			shadowMap.resetTimings();
+		}
+
 		glfwSwapBuffers(window);
+		pacer.endFrame();
+
+#ifdef ALLOCATION_AUDIT
+		auditPhase(FramePhase::Other);
+		allocationAudit.endFrame(auditLog);
+#endif
 	}
 
+	int result = 0;
+#ifdef ALLOCATION_AUDIT
+	if (auditLog) {
+		WriteAuditSummary(auditLog, allocationAudit);
+		fclose(auditLog);
+	}
+	if (allocationAudit.failedFrames() > 0) result = -6;
+#endif
+
+	impactCounter.stop();
+	gScene->setSimulationEventCallback(nullptr);
 	glfwTerminate();
-	return 0;
+	return result;
 }
\ No newline at end of file
@@ -0,0 +1,82 @@
+#include <windows.h>
+#include "material.h"
+#include <stb_image.h>
+
+void MaterialTable::init(const char* const* paths, unsigned int count) {
+	std::vector<unsigned char*> images(count, nullptr);
+	int width = 0, height = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		int w, h, c;
+		images[i] = stbi_load(paths[i], &w, &h, &c, 4);
+		if (!images[i]) {
+			MessageBoxA(NULL, paths[i], "Failed to load material texture", MB_OK | MB_ICONWARNING);
+			continue;
+		}
+		if (width == 0) {
+			width = w;
+			height = h;
+		}
+		else if (w != width || h != height) {
+			// a mismatched layer stays white rather than being resampled
+			MessageBoxA(NULL, paths[i], "Material texture size differs from the first layer", MB_OK | MB_ICONWARNING);
+			stbi_image_free(images[i]);
+			images[i] = nullptr;
+		}
+	}
+	if (width == 0) width = height = 1;
+
+	glGenTextures(1, &texture);
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, width, height, count + 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+	std::vector<unsigned char> white((size_t)width * height * 4, 255);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, WhiteLayer, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, white.data());
+	for (unsigned int i = 0; i < count; i++) {
+		const unsigned char* data = images[i] ? images[i] : white.data();
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i + 1, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		if (images[i]) stbi_image_free(images[i]);
+	}
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+	// nothing else uses this unit, so the array stays bound for the whole run
+	glActiveTexture(GL_TEXTURE0);
+
+	// index 0 is the fallback, plain white
+	entries.assign(1, glm::vec4(1.0f, 1.0f, 1.0f, (float)WhiteLayer));
+	revision++;
+}
+
+unsigned int MaterialTable::find(const glm::vec3& tint, unsigned int layer) {
+	glm::vec4 entry(tint, (float)layer);
+	for (unsigned int i = 0; i < entries.size(); i++) {
+		if (entries[i] == entry) return i;
+	}
+	if (entries.size() >= MaxMaterials) return 0;
+
+	entries.push_back(entry);
+	revision++;
+	return (unsigned int)entries.size() - 1;
+}
+
+void MaterialTable::apply(Shader& shader) {
+	Upload* upload = nullptr;
+	for (Upload& u : uploads) {
+		if (u.program == shader.ID) upload = &u;
+	}
+	if (upload && upload->revision == revision) return;
+	if (!upload) {
+		uploads.push_back(Upload{ shader.ID, 0 });
+		upload = &uploads.back();
+	}
+
+	shader.use();
+	shader.setVec4Array("materials", entries.data(), (int)entries.size());
+	shader.setInt("materialTextures", (int)textureUnit);
+	upload->revision = revision;
+}
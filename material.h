@@ -0,0 +1,34 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "shader.h"
+
+// tint + texture layer per material index. Instances carry the index, the shader
+// looks it up in a uniform array and samples one GL_TEXTURE_2D_ARRAY, so bodies
+// with different looks share a draw and nothing is rebound per draw
+class MaterialTable {
+public:
+	static const unsigned int MaxMaterials = 64; // size of the materials[] uniform in shader_code.h
+	static const unsigned int WhiteLayer = 0;
+	unsigned int textureUnit = 2; // 0 is used by the render queue, 1 by the shadow map
+
+	// layer 0 is plain white, each image becomes the next layer and must match the size of the first
+	void init(const char* const* paths, unsigned int count);
+	// index of the material with this tint and layer, added on first use, 0 once the table is full
+	unsigned int find(const glm::vec3& tint, unsigned int layer);
+	// uploads the table to programs that have not seen its latest version
+	void apply(Shader& shader);
+	unsigned int count() const { return (unsigned int)entries.size(); }
+
+private:
+	struct Upload {
+		unsigned int program;
+		unsigned int revision;
+	};
+
+	std::vector<glm::vec4> entries; // tint in xyz, layer in w
+	std::vector<Upload> uploads;
+	unsigned int revision = 1;
+	unsigned int texture = 0;
+};
@@ -0,0 +1,295 @@
+#include <windows.h>
+#include "mesh.h"
+#include <cmath>
+#include <cstring>
+
+unsigned short floatToHalf(float value) {
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	unsigned int sign = (bits >> 16) & 0x8000;
+	int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+	unsigned int mantissa = bits & 0x7FFFFF;
+
+	if (exponent <= 0) {
+		// subnormal half, or too small and flushed to zero
+		if (exponent < -10) return (unsigned short)sign;
+		mantissa |= 0x800000;
+		unsigned int shift = 14 - exponent;
+		unsigned int half = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1) half++;
+		return (unsigned short)(sign | half);
+	}
+	if (exponent >= 31) return (unsigned short)(sign | 0x7C00);
+
+	// rounding may carry into the exponent, which is still the right answer
+	unsigned int half = sign | (exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000) half++;
+	return (unsigned short)half;
+}
+
+unsigned int packNormal(const glm::vec3& normal) {
+	auto pack = [](float v) {
+		v = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+		return (unsigned int)(int)roundf(v * 511.0f) & 0x3FF;
+	};
+	return pack(normal.x) | (pack(normal.y) << 10) | (pack(normal.z) << 20);
+}
+
+void generateSphere(float radius,
+	unsigned int sectorCount,
+	unsigned int stackCount,
+	std::vector<float>& vertices,
+	std::vector<unsigned int>& indices)
+{
+	const float PI = 3.14159265359f;
+
+	vertices.reserve(vertices.size() + (stackCount + 1) * (sectorCount + 1) * 8);
+	indices.reserve(indices.size() + stackCount * sectorCount * 6);
+
+	for (unsigned int i = 0; i <= stackCount; ++i)
+	{
+		float stackAngle = PI / 2 - i * PI / stackCount; // pi/2 -> -pi/2
+		float xy = radius * cosf(stackAngle);
+		float z = radius * sinf(stackAngle);
+
+		for (unsigned int j = 0; j <= sectorCount; ++j)
+		{
+			float sectorAngle = j * 2 * PI / sectorCount; // 0 -> 2pi
+
+			// position
+			float x = xy * cosf(sectorAngle);
+			float y = xy * sinf(sectorAngle);
+			vertices.push_back(x);
+			vertices.push_back(y);
+			vertices.push_back(z);
+
+			// normal (normalized)
+			float nx = x / radius;
+			float ny = y / radius;
+			float nz = z / radius;
+			vertices.push_back(nx);
+			vertices.push_back(ny);
+			vertices.push_back(nz);
+
+			// texture coords
+			float s = (float)j / sectorCount;
+			float t = (float)i / stackCount;
+			vertices.push_back(s);
+			vertices.push_back(t);
+		}
+	}
+
+	// indices
+	for (unsigned int i = 0; i < stackCount; ++i)
+	{
+		unsigned int k1 = i * (sectorCount + 1);
+		unsigned int k2 = k1 + sectorCount + 1;
+
+		for (unsigned int j = 0; j < sectorCount; ++j, ++k1, ++k2)
+		{
+			if (i != 0)
+			{
+				indices.push_back(k1);
+				indices.push_back(k2);
+				indices.push_back(k1 + 1);
+			}
+
+			if (i != (stackCount - 1))
+			{
+				indices.push_back(k1 + 1);
+				indices.push_back(k2);
+				indices.push_back(k2 + 1);
+			}
+		}
+	}
+}
+
+static const int VertexCacheSize = 32;
+
+static float vertexCacheScore(int cachePosition, int remainingTriangles) {
+	if (remainingTriangles == 0) return -1.0f;
+
+	float score = 0.0f;
+	if (cachePosition >= 0) {
+		// the last triangle's vertices get a fixed score so the next one doesn't just reuse them
+		if (cachePosition < 3) score = 0.75f;
+		else score = powf(1.0f - (cachePosition - 3) / (float)(VertexCacheSize - 3), 1.5f);
+	}
+	// favour finishing off vertices with few triangles left
+	score += 2.0f / sqrtf((float)remainingTriangles);
+	return score;
+}
+
+void optimizeVertexCache(unsigned int* indices, size_t indexCount, unsigned int vertexCount) {
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0) return;
+
+	// triangles touching each vertex
+	std::vector<unsigned int> offsets(vertexCount + 1, 0);
+	for (size_t i = 0; i < indexCount; i++) offsets[indices[i] + 1]++;
+	for (unsigned int v = 0; v < vertexCount; v++) offsets[v + 1] += offsets[v];
+
+	std::vector<int> remaining(vertexCount, 0);
+	std::vector<unsigned int> vertexTriangles(indexCount);
+	for (size_t i = 0; i < indexCount; i++) {
+		unsigned int v = indices[i];
+		vertexTriangles[offsets[v] + remaining[v]++] = (unsigned int)(i / 3);
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for (unsigned int v = 0; v < vertexCount; v++) vertexScore[v] = vertexCacheScore(-1, remaining[v]);
+
+	std::vector<float> triangleScore(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	for (size_t t = 0; t < triangleCount; t++) {
+		triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+	}
+
+	std::vector<unsigned int> output;
+	output.reserve(indexCount);
+	std::vector<unsigned int> cache, nextCache;
+	cache.reserve(VertexCacheSize + 3);
+	nextCache.reserve(VertexCacheSize + 3);
+
+	long long best = -1;
+	while (output.size() < triangleCount * 3) {
+		if (best < 0) {
+			// nothing in cache connects to anything left, fall back to a full scan
+			float bestScore = -1.0f;
+			for (size_t t = 0; t < triangleCount; t++) {
+				if (!emitted[t] && triangleScore[t] > bestScore) {
+					bestScore = triangleScore[t];
+					best = (long long)t;
+				}
+			}
+		}
+
+		size_t triangle = (size_t)best;
+		emitted[triangle] = true;
+		for (int k = 0; k < 3; k++) {
+			unsigned int v = indices[triangle * 3 + k];
+			output.push_back(v);
+
+			unsigned int* list = &vertexTriangles[offsets[v]];
+			for (int i = 0; i < remaining[v]; i++) {
+				if (list[i] == triangle) {
+					list[i] = list[remaining[v] - 1];
+					break;
+				}
+			}
+			remaining[v]--;
+		}
+
+		// move the triangle's vertices to the front of the LRU cache
+		nextCache.clear();
+		for (int k = 0; k < 3; k++) nextCache.push_back(indices[triangle * 3 + k]);
+		for (unsigned int v : cache) {
+			if (v != nextCache[0] && v != nextCache[1] && v != nextCache[2]) nextCache.push_back(v);
+		}
+
+		for (size_t i = 0; i < nextCache.size(); i++) {
+			unsigned int v = nextCache[i];
+			cachePosition[v] = i < (size_t)VertexCacheSize ? (int)i : -1;
+			vertexScore[v] = vertexCacheScore(cachePosition[v], remaining[v]);
+		}
+
+		// rescore triangles around anything that changed and pick the next one
+		best = -1;
+		float bestScore = -1.0f;
+		for (unsigned int v : nextCache) {
+			for (int i = 0; i < remaining[v]; i++) {
+				unsigned int t = vertexTriangles[offsets[v] + i];
+				triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+				if (triangleScore[t] > bestScore) {
+					bestScore = triangleScore[t];
+					best = t;
+				}
+			}
+		}
+
+		if (nextCache.size() > (size_t)VertexCacheSize) nextCache.resize(VertexCacheSize);
+		cache.swap(nextCache);
+	}
+
+	memcpy(indices, output.data(), indexCount * sizeof(unsigned int));
+}
+
+GLsizei uploadMesh(const float* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount, ObjectBuffer& buffer) {
+	// 16 bit indices can't address more, such a mesh is refused rather than drawn wrapped
+	if (vertexCount > 65536) {
+		MessageBoxA(NULL, "Mesh has more than 65536 vertices and can't use 16 bit indices", "Mesh upload failed", MB_OK | MB_ICONWARNING);
+		buffer = ObjectBuffer{};
+		return 0;
+	}
+
+	std::vector<unsigned int> ordered(indices, indices + indexCount);
+	optimizeVertexCache(ordered.data(), ordered.size(), vertexCount);
+
+	std::vector<unsigned short> shortIndices(indexCount);
+	for (unsigned int i = 0; i < indexCount; i++) shortIndices[i] = (unsigned short)ordered[i];
+
+	std::vector<PackedVertex> packed(vertexCount);
+	for (unsigned int v = 0; v < vertexCount; v++) {
+		const float* in = vertices + v * 8;
+		PackedVertex& out = packed[v];
+		out.position[0] = in[0];
+		out.position[1] = in[1];
+		out.position[2] = in[2];
+		out.normal = packNormal(glm::vec3(in[3], in[4], in[5]));
+		out.texCoord[0] = floatToHalf(in[6]);
+		out.texCoord[1] = floatToHalf(in[7]);
+	}
+
+	glGenVertexArrays(1, &buffer.VAO);
+	glGenBuffers(1, &buffer.VBO);
+	glGenBuffers(1, &buffer.EBO);
+
+	glBindVertexArray(buffer.VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer.VBO);
+	glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(PackedVertex), packed.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(unsigned short), shortIndices.data(), GL_STATIC_DRAW);
+
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)0);                     // position
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (void*)(3 * sizeof(float))); // normal
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)(4 * sizeof(float)));      // texcoord
+	glEnableVertexAttribArray(2);
+
+	glBindVertexArray(0);
+
+	return (GLsizei)indexCount;
+}
+
+int MeshLodChain::select(float pixelRadius) const {
+	for (size_t i = 0; i < lods.size(); i++) {
+		if (pixelRadius >= lods[i].minPixelRadius) return (int)i;
+	}
+	return (int)lods.size() - 1;
+}
+
+void buildSphereLods(float radius, MeshLodChain& chain) {
+	struct Level { unsigned int sectors, stacks; float minPixelRadius; };
+	const Level levels[] = {
+		{ 32, 24, 120.0f },
+		{ 20, 14, 40.0f },
+		{ 12, 8, 12.0f },
+		{ 8, 6, 0.0f },
+	};
+
+	std::vector<float> vertices;
+	std::vector<unsigned int> indices;
+	for (const Level& level : levels) {
+		vertices.clear();
+		indices.clear();
+		generateSphere(radius, level.sectors, level.stacks, vertices, indices);
+
+		MeshLod lod;
+		lod.indexCount = uploadMesh(vertices.data(), (unsigned int)(vertices.size() / 8), indices.data(), (unsigned int)indices.size(), lod.buffer);
+		lod.minPixelRadius = level.minPixelRadius;
+		chain.lods.push_back(lod);
+	}
+}
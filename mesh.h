@@ -0,0 +1,42 @@
+#pragma once
+#include <glad/glad.h>
+#include <vector>
+#include "objects.h"
+
+// compact vertex layout used for everything uploaded through uploadMesh:
+// float position, 10:10:10:2 normal, half float uv, 16 bit indices
+struct PackedVertex {
+	float position[3];
+	unsigned int normal;
+	unsigned short texCoord[2];
+};
+
+struct MeshLod {
+	ObjectBuffer buffer;
+	GLsizei indexCount;
+	float minPixelRadius; // used while the projected radius is at least this big
+};
+
+struct MeshLodChain {
+	std::vector<MeshLod> lods;
+	int select(float pixelRadius) const;
+};
+
+unsigned short floatToHalf(float value);
+unsigned int packNormal(const glm::vec3& normal);
+
+// builds the intermediate 8 float position/normal/uv layout
+void generateSphere(float radius,
+	unsigned int sectorCount,
+	unsigned int stackCount,
+	std::vector<float>& vertices,
+	std::vector<unsigned int>& indices);
+
+// reorders triangles for the post-transform vertex cache (Forsyth)
+void optimizeVertexCache(unsigned int* indices, size_t indexCount, unsigned int vertexCount);
+
+// optimizes, packs and uploads an 8 float mesh, returns the index count to draw with GL_UNSIGNED_SHORT.
+// Meshes over 65536 vertices are refused with a warning, 0 is returned and the buffer left empty
+GLsizei uploadMesh(const float* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount, ObjectBuffer& buffer);
+
+void buildSphereLods(float radius, MeshLodChain& chain);
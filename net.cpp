@@ -0,0 +1,72 @@
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "net.h"
+
+#pragma comment(lib, "ws2_32.lib")
+
+bool netStartup() {
+	WSADATA data;
+	return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+}
+
+void netShutdown() {
+	WSACleanup();
+}
+
+bool parseAddress(const char* text, unsigned short port, NetAddress& address) {
+	in_addr parsed;
+	if (inet_pton(AF_INET, text, &parsed) != 1) return false;
+	address.ip = ntohl(parsed.s_addr);
+	address.port = port;
+	return true;
+}
+
+UdpSocket::~UdpSocket() {
+	close();
+}
+
+bool UdpSocket::open(unsigned short port) {
+	SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (s == INVALID_SOCKET) return false;
+
+	sockaddr_in local = {};
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+	local.sin_port = htons(port);
+	u_long nonBlocking = 1;
+	// snapshots for big scenes arrive as bursts of fragments
+	int bufferSize = 8 * 1024 * 1024;
+	setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char*)&bufferSize, sizeof(bufferSize));
+	setsockopt(s, SOL_SOCKET, SO_SNDBUF, (const char*)&bufferSize, sizeof(bufferSize));
+	if (bind(s, (sockaddr*)&local, sizeof(local)) != 0 || ioctlsocket(s, FIONBIO, &nonBlocking) != 0) {
+		closesocket(s);
+		return false;
+	}
+
+	handle = (uintptr_t)s;
+	return true;
+}
+
+void UdpSocket::close() {
+	if (handle == ~(uintptr_t)0) return;
+	closesocket((SOCKET)handle);
+	handle = ~(uintptr_t)0;
+}
+
+bool UdpSocket::sendTo(const NetAddress& to, const void* data, int size) {
+	sockaddr_in remote = {};
+	remote.sin_family = AF_INET;
+	remote.sin_addr.s_addr = htonl(to.ip);
+	remote.sin_port = htons(to.port);
+	return sendto((SOCKET)handle, (const char*)data, size, 0, (sockaddr*)&remote, sizeof(remote)) == size;
+}
+
+int UdpSocket::receive(void* buffer, int size, NetAddress& from) {
+	sockaddr_in remote = {};
+	int length = sizeof(remote);
+	int received = recvfrom((SOCKET)handle, (char*)buffer, size, 0, (sockaddr*)&remote, &length);
+	if (received < 0) return -1;
+	from.ip = ntohl(remote.sin_addr.s_addr);
+	from.port = ntohs(remote.sin_port);
+	return received;
+}
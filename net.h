@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+
+// ipv4 address in host byte order, kept free of winsock headers so it can be
+// included next to windows.h
+struct NetAddress {
+	unsigned int ip;
+	unsigned short port;
+
+	bool operator==(const NetAddress& other) const { return ip == other.ip && port == other.port; }
+};
+
+bool netStartup();
+void netShutdown();
+bool parseAddress(const char* text, unsigned short port, NetAddress& address);
+
+// non blocking udp socket
+class UdpSocket {
+public:
+	~UdpSocket();
+
+	bool open(unsigned short port); // 0 picks any free port
+	void close();
+	bool sendTo(const NetAddress& to, const void* data, int size);
+	// returns the datagram size, or -1 when nothing is waiting
+	int receive(void* buffer, int size, NetAddress& from);
+
+private:
+	uintptr_t handle = ~(uintptr_t)0;
+};
@@ -0,0 +1,36 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <PxPhysicsAPI.h>
+
+struct ObjectBuffer {
+	unsigned int VAO, VBO, EBO;
+};
+
+struct Cube {
+	glm::vec3 Scale;
+	unsigned int Material; // index into the MaterialTable
+	physx::PxRigidDynamic* pxRigidBody;
+};
+
+// one element of the per instance stream: model matrix at locations 3-6, material index at 7
+struct InstanceData {
+	glm::mat4 model;
+	unsigned int material;
+};
+
+struct Light {
+	glm::vec3 pos;
+	glm::vec3 color;
+};
+
+inline glm::mat4 GetCubeModel(const Cube& cube) {
+	glm::mat4 model(1.0f);
+	physx::PxTransform pose = cube.pxRigidBody->getGlobalPose();
+	model = glm::translate(model, glm::vec3(pose.p.x,pose.p.y,pose.p.z));
+	glm::quat rot(pose.q.w, pose.q.x, pose.q.y, pose.q.z);
+	model *= glm::mat4_cast(rot);
+	model = glm::scale(model, cube.Scale);
+	return model;
+}
@@ -0,0 +1,112 @@
+#include "physics.h"
+#include "allocaudit.h"
+
+using namespace physx;
+
+#ifdef ALLOCATION_AUDIT
+// counts every PhysX allocation against the current frame phase
+class AuditedAllocator : public PxAllocatorCallback {
+public:
+	void* allocate(size_t size, const char* typeName, const char* filename, int line) override {
+		auditPhysXAllocation(size);
+		return inner.allocate(size, typeName, filename, line);
+	}
+	void deallocate(void* ptr) override {
+		if (ptr) auditPhysXFree();
+		inner.deallocate(ptr);
+	}
+
+private:
+	PxDefaultAllocator inner;
+};
+AuditedAllocator gAllocator;
+#else
+PxDefaultAllocator gAllocator;
+#endif
+PxDefaultErrorCallback gErrorCallback;
+
+PxFoundation* gFoundation = nullptr;
+PxPhysics* gPhysics = nullptr;
+PxScene* gScene = nullptr;
+PxMaterial* gMaterial = nullptr;
+PxMaterial* gBallMaterial = nullptr;
+
+// contact force an actor has to exceed before its pairs get reported
+static const PxReal sphereReportForce = 100.0f;
+
+PxFilterFlags physicsFilterShader(
+	PxFilterObjectAttributes attributes0, PxFilterData filterData0,
+	PxFilterObjectAttributes attributes1, PxFilterData filterData1,
+	PxPairFlags& pairFlags, const void* constantBlock, PxU32 constantBlockSize) {
+	if (PxFilterObjectIsTrigger(attributes0) || PxFilterObjectIsTrigger(attributes1)) {
+		pairFlags = PxPairFlag::eTRIGGER_DEFAULT;
+		return PxFilterFlag::eDEFAULT;
+	}
+
+	// kinematic and static bodies never need contacts with each other (frozen lod bodies, crowd agents)
+	bool simulated0 = PxGetFilterObjectType(attributes0) == PxFilterObjectType::eRIGID_DYNAMIC && !PxFilterObjectIsKinematic(attributes0);
+	bool simulated1 = PxGetFilterObjectType(attributes1) == PxFilterObjectType::eRIGID_DYNAMIC && !PxFilterObjectIsKinematic(attributes1);
+	if (!simulated0 && !simulated1) return PxFilterFlag::eSUPPRESS;
+
+	pairFlags = PxPairFlag::eCONTACT_DEFAULT;
+	// only pairs somebody asked for get reported, everything else stays off the event stream
+	if ((filterData0.word0 & filterData1.word1) || (filterData1.word0 & filterData0.word1)) {
+		pairFlags |= PxPairFlag::eNOTIFY_THRESHOLD_FORCE_FOUND | PxPairFlag::eNOTIFY_CONTACT_POINTS;
+	}
+	return PxFilterFlag::eDEFAULT;
+}
+
+void initPhysX() {
+	gFoundation = PxCreateFoundation(PX_PHYSICS_VERSION, gAllocator, gErrorCallback);
+	gPhysics = PxCreatePhysics(PX_PHYSICS_VERSION, *gFoundation, PxTolerancesScale(), true, nullptr);
+
+	PxSceneDesc sceneDesc(gPhysics->getTolerancesScale());
+	sceneDesc.gravity = PxVec3(0.0f, -9.81f, 0.0f);
+	PxDefaultCpuDispatcher* dispatcher = PxDefaultCpuDispatcherCreate(2);
+	sceneDesc.cpuDispatcher = dispatcher;
+	sceneDesc.filterShader = physicsFilterShader;
+
+	gScene = gPhysics->createScene(sceneDesc);
+
+	gMaterial = gPhysics->createMaterial(0.5f, 0.5f, 0.1f);
+	gBallMaterial = gPhysics->createMaterial(0.9f, 0.9f, 0.7f);
+
+	// create ground
+	PxRigidStatic* ground = PxCreatePlane(*gPhysics, PxPlane(0, 1, 0, 0), *gMaterial);
+	PxShape* groundShape = nullptr;
+	ground->getShapes(&groundShape, 1);
+	groundShape->setSimulationFilterData(PxFilterData(BodyKindGround, 0, 0, 0));
+	gScene->addActor(*ground);
+}
+
+PxRigidDynamic* createPxCube(const PxVec3& position, const PxVec3& halfExtents, bool addToScene) {
+	PxBoxGeometry geometry(halfExtents);
+	PxTransform transform(position);
+	PxRigidDynamic* body = gPhysics->createRigidDynamic(transform);
+	PxShape* shape = gPhysics->createShape(geometry, *gMaterial);
+	shape->setSimulationFilterData(PxFilterData(BodyKindCube, 0, 0, 0));
+	body->attachShape(*shape);
+	body->setActorFlag(PxActorFlag::eSEND_SLEEP_NOTIFIES, true);
+	PxRigidBodyExt::updateMassAndInertia(*body, 0.15f);
+	if (addToScene) gScene->addActor(*body);
+	return body;
+}
+
+PxRigidDynamic* createPxSphere(const PxVec3& position, PxReal radius) {
+	PxSphereGeometry geometry(radius);          // radius = 1
+	PxTransform transform(position);            // position in world
+	PxRigidDynamic* body = gPhysics->createRigidDynamic(transform);
+
+	PxShape* shape = gPhysics->createShape(geometry, *gBallMaterial);
+	shape->setSimulationFilterData(PxFilterData(BodyKindSphere, BodyKindGround | BodyKindCube | BodyKindSphere | BodyKindAgent, 0, 0));
+	body->setContactReportThreshold(sphereReportForce);
+	body->setActorFlag(PxActorFlag::eSEND_SLEEP_NOTIFIES, true);
+	body->setLinearDamping(0.1f);
+	body->setAngularDamping(0.2f);
+	body->attachShape(*shape);
+
+	PxRigidBodyExt::updateMassAndInertia(*body, 7.5f);
+
+	gScene->addActor(*body);
+	return body;
+}
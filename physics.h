@@ -0,0 +1,26 @@
+#pragma once
+#include <PxPhysicsAPI.h>
+
+// stored in PxFilterData::word0 of every shape, word1 holds the kinds it wants contact reports against
+enum BodyKind : unsigned int {
+	BodyKindGround = 1,
+	BodyKindCube = 2,
+	BodyKindSphere = 4,
+	BodyKindAgent = 8
+};
+
+extern physx::PxFoundation* gFoundation;
+extern physx::PxPhysics* gPhysics;
+extern physx::PxScene* gScene;
+extern physx::PxMaterial* gMaterial;
+extern physx::PxMaterial* gBallMaterial;
+
+physx::PxFilterFlags physicsFilterShader(
+	physx::PxFilterObjectAttributes attributes0, physx::PxFilterData filterData0,
+	physx::PxFilterObjectAttributes attributes1, physx::PxFilterData filterData1,
+	physx::PxPairFlags& pairFlags, const void* constantBlock, physx::PxU32 constantBlockSize);
+
+void initPhysX();
+// addToScene = false only builds the actor, safe off the simulation thread (world streaming)
+physx::PxRigidDynamic* createPxCube(const physx::PxVec3& position, const physx::PxVec3& halfExtents, bool addToScene = true);
+physx::PxRigidDynamic* createPxSphere(const physx::PxVec3& position, physx::PxReal radius = 1.0f);
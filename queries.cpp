@@ -0,0 +1,136 @@
+#include "queries.h"
+#include "physics.h"
+#include <chrono>
+#include <vector>
+
+using namespace physx;
+
+static void storeHit(const PxLocationHit& block, bool hasBlock, QueryHit& out) {
+	out.hit = hasBlock;
+	if (!hasBlock) {
+		out.actor = nullptr;
+		out.shape = nullptr;
+		return;
+	}
+	out.actor = block.actor;
+	out.shape = block.shape;
+	out.position = block.position;
+	out.normal = block.normal;
+	out.distance = block.distance;
+}
+
+SceneQueryBatch::SceneQueryBatch(PxScene& scene, JobPool& jobs)
+	: filter(PxQueryFlag::eSTATIC | PxQueryFlag::eDYNAMIC), scene(scene), jobs(jobs) {
+}
+
+void SceneQueryBatch::raycasts(const RayQuery* queries, QueryHit* hits, size_t count) {
+	jobs.parallelFor(count, grain, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const RayQuery& query = queries[i];
+			PxRaycastBuffer buffer;
+			bool hit = scene.raycast(query.origin, query.direction, query.maxDistance, buffer, PxHitFlag::eDEFAULT, filter);
+			storeHit(buffer.block, hit && buffer.hasBlock, hits[i]);
+		}
+	});
+}
+
+void SceneQueryBatch::sweeps(const SweepQuery* queries, QueryHit* hits, size_t count) {
+	jobs.parallelFor(count, grain, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const SweepQuery& query = queries[i];
+			PxSweepBuffer buffer;
+			bool hit = scene.sweep(query.geometry.any(), query.pose, query.direction, query.maxDistance, buffer, PxHitFlag::eDEFAULT, filter);
+			storeHit(buffer.block, hit && buffer.hasBlock, hits[i]);
+		}
+	});
+}
+
+void SceneQueryBatch::overlaps(const OverlapQuery* queries, PxRigidActor** actors, unsigned int* counts, unsigned int maxPerQuery, size_t count) {
+	// overlaps want every touching shape, not just the first blocking one
+	PxQueryFilterData touchFilter = filter;
+	touchFilter.flags |= PxQueryFlag::eNO_BLOCK;
+
+	jobs.parallelFor(count, grain, [&](size_t begin, size_t end) {
+		const PxU32 maxTouches = 64;
+		PxOverlapHit touches[maxTouches];
+		for (size_t i = begin; i < end; i++) {
+			const OverlapQuery& query = queries[i];
+			PxOverlapBuffer buffer(touches, maxTouches);
+			scene.overlap(query.geometry.any(), query.pose, buffer, touchFilter);
+
+			unsigned int written = 0;
+			PxRigidActor** out = actors + i * maxPerQuery;
+			for (PxU32 t = 0; t < buffer.getNbTouches() && written < maxPerQuery; t++) {
+				out[written++] = buffer.getTouch(t).actor;
+			}
+			counts[i] = written;
+		}
+	});
+}
+
+void runQueryBenchmark(FILE* out) {
+	const size_t rayCounts[] = { 10000, 30000, 100000 };
+	const int frames = 20;
+
+	for (int k = 0; k < 10; k++) {
+		for (int i = 0; i < 10; i++) {
+			for (int j = 0; j < 10; j++) {
+				createPxCube(PxVec3(i * 1.f, 0.1f + k * 1.05f, j * 1.f), PxVec3(0.5f, 0.5f, 0.5f));
+			}
+		}
+	}
+	// let the stack settle so the query tree matches a typical frame
+	for (int s = 0; s < 60; s++) {
+		gScene->simulate(1.0f / 60.0f);
+		gScene->fetchResults(true);
+	}
+
+	JobPool jobs;
+	SceneQueryBatch batch(*gScene, jobs);
+	fprintf(out, "query benchmark, %u threads, %d frames per count\n", jobs.threadCount(), frames);
+
+	std::vector<RayQuery> rays;
+	std::vector<QueryHit> hits;
+	for (size_t count : rayCounts) {
+		rays.resize(count);
+		hits.resize(count);
+
+		// rays from a ring around the stack aimed at random points inside it
+		unsigned int seed = 12345;
+		auto random = [&seed]() {
+			seed = seed * 1664525u + 1013904223u;
+			return (seed >> 8) / (float)(1 << 24);
+		};
+		for (size_t r = 0; r < count; r++) {
+			float angle = random() * PxTwoPi;
+			PxVec3 origin(4.5f + cosf(angle) * 30.0f, 1.0f + random() * 15.0f, 4.5f + sinf(angle) * 30.0f);
+			PxVec3 target(random() * 9.0f, random() * 10.0f, random() * 9.0f);
+			rays[r].origin = origin;
+			rays[r].direction = (target - origin).getNormalized();
+			rays[r].maxDistance = 100.0f;
+		}
+
+		double serialMs = 0.0, batchedMs = 0.0;
+		size_t hitCount = 0;
+		for (int f = 0; f < frames; f++) {
+			auto t0 = std::chrono::high_resolution_clock::now();
+			for (size_t r = 0; r < count; r++) {
+				PxRaycastBuffer buffer;
+				gScene->raycast(rays[r].origin, rays[r].direction, rays[r].maxDistance, buffer);
+			}
+			auto t1 = std::chrono::high_resolution_clock::now();
+			batch.raycasts(rays.data(), hits.data(), count);
+			auto t2 = std::chrono::high_resolution_clock::now();
+
+			serialMs += std::chrono::duration<double, std::milli>(t1 - t0).count();
+			batchedMs += std::chrono::duration<double, std::milli>(t2 - t1).count();
+		}
+		for (const QueryHit& hit : hits) hitCount += hit.hit ? 1 : 0;
+
+		serialMs /= frames;
+		batchedMs /= frames;
+		fprintf(out, "rays %6zu  serial %8.3f ms  batched %8.3f ms  %6.2f Mrays/s  hit rate %5.1f%%\n",
+			count, serialMs, batchedMs, count / (batchedMs * 1000.0), 100.0 * hitCount / count);
+		fflush(out);
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <PxPhysicsAPI.h>
+#include <cstdio>
+#include "jobs.h"
+
+struct RayQuery {
+	physx::PxVec3 origin;
+	physx::PxVec3 direction; // normalized
+	float maxDistance;
+};
+
+struct SweepQuery {
+	physx::PxGeometryHolder geometry;
+	physx::PxTransform pose;
+	physx::PxVec3 direction; // normalized
+	float maxDistance;
+};
+
+struct OverlapQuery {
+	physx::PxGeometryHolder geometry;
+	physx::PxTransform pose;
+};
+
+struct QueryHit {
+	bool hit;
+	physx::PxRigidActor* actor;
+	physx::PxShape* shape;
+	physx::PxVec3 position;
+	physx::PxVec3 normal;
+	float distance;
+};
+
+// runs arrays of scene queries across the job pool. The scene is only read, so
+// call it between fetchResults and the next simulate. Results go into arrays the
+// caller owns, one slot per query, nothing is allocated per call
+class SceneQueryBatch {
+public:
+	physx::PxQueryFilterData filter;
+	size_t grain = 256;
+
+	SceneQueryBatch(physx::PxScene& scene, JobPool& jobs);
+
+	void raycasts(const RayQuery* queries, QueryHit* hits, size_t count);
+	void sweeps(const SweepQuery* queries, QueryHit* hits, size_t count);
+	// query i writes up to maxPerQuery actors at actors[i * maxPerQuery] and the number written to counts[i]
+	void overlaps(const OverlapQuery* queries, physx::PxRigidActor** actors, unsigned int* counts, unsigned int maxPerQuery, size_t count);
+
+private:
+	physx::PxScene& scene;
+	JobPool& jobs;
+};
+
+// rays per second against the cube stack for 10k-100k rays per frame, written to out
+void runQueryBenchmark(FILE* out);
@@ -0,0 +1,134 @@
+#include "renderqueue.h"
+#include <algorithm>
+
+static const unsigned int Unbound = 0xFFFFFFFF;
+
+unsigned long long RenderQueue::makeKey(RenderLayer layer, float depth, unsigned int program, unsigned int VAO, unsigned int texture) {
+	// layer | depth | program | vao | texture, so opaque draws go front to back and
+	// draws at the same depth bucket still group by state
+	const float maxDepth = 1000.0f;
+	float d = depth < 0.0f ? 0.0f : (depth > maxDepth ? maxDepth : depth);
+	unsigned long long depthBits = (unsigned long long)(d / maxDepth * 0xFFFFF);
+
+	unsigned long long key = 0;
+	key |= (unsigned long long)layer << 62;
+	key |= (depthBits & 0xFFFFF) << 42;
+	key |= (unsigned long long)(program & 0x3FF) << 32;
+	key |= (unsigned long long)(VAO & 0xFFFF) << 16;
+	key |= (unsigned long long)(texture & 0xFFFF);
+	return key;
+}
+
+DrawPacket RenderQueue::packet(Shader& shader, unsigned int VAO, GLenum indexType, GLsizei count) {
+	DrawPacket packet;
+	packet.key = 0;
+	packet.shader = &shader;
+	packet.VAO = VAO;
+	packet.textureTarget = 0;
+	packet.texture = 0;
+	packet.depthFunc = GL_LESS;
+	packet.indexType = indexType;
+	packet.count = count;
+	packet.instanceCount = 0;
+	packet.hasModel = false;
+	packet.hasColor = false;
+	packet.hasView = false;
+	return packet;
+}
+
+void RenderQueue::begin(const FrameUniforms& frameUniforms) {
+	frame = frameUniforms;
+	packets.clear();
+	framePrograms.clear();
+	frameStats = RenderStats();
+
+	// anything outside the queue may have touched GL state since last frame
+	boundProgram = Unbound;
+	boundVAO = Unbound;
+	boundTexture = Unbound;
+	depthFunc = GL_LESS;
+	glDepthFunc(GL_LESS);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void RenderQueue::submit(const DrawPacket& packet) {
+	packets.push_back(packet);
+}
+
+void RenderQueue::reserve(size_t count) {
+	packets.reserve(count);
+	sorted.reserve(count);
+}
+
+void RenderQueue::bind(const DrawPacket& packet) {
+	Shader& shader = *packet.shader;
+
+	if (shader.ID != boundProgram) {
+		shader.use();
+		boundProgram = shader.ID;
+		frameStats.programBinds++;
+
+		if (std::find(framePrograms.begin(), framePrograms.end(), shader.ID) == framePrograms.end()) {
+			framePrograms.push_back(shader.ID);
+			shader.setMat4("projection", frame.projection);
+			shader.setMat4("view", frame.view);
+			shader.setVec3("lightColor", frame.lightColor);
+			shader.setVec3("lightPos", frame.lightPos);
+			shader.setVec3("viewPos", frame.viewPos);
+			shader.setMat4("lightSpace", frame.lightSpace);
+			shader.setInt("shadowMap", 1);
+		}
+	}
+
+	if (packet.VAO != boundVAO) {
+		glBindVertexArray(packet.VAO);
+		boundVAO = packet.VAO;
+		frameStats.vaoBinds++;
+	}
+
+	if (packet.textureTarget != 0 && packet.texture != boundTexture) {
+		glBindTexture(packet.textureTarget, packet.texture);
+		boundTexture = packet.texture;
+		frameStats.textureBinds++;
+	}
+
+	if (packet.depthFunc != depthFunc) {
+		glDepthFunc(packet.depthFunc);
+		depthFunc = packet.depthFunc;
+		frameStats.depthChanges++;
+	}
+
+	if (packet.hasModel) shader.setMat4("model", packet.model);
+	if (packet.hasColor) shader.setVec3("objectColor", packet.color);
+	if (packet.hasView) shader.setMat4("view", packet.view);
+}
+
+void RenderQueue::flush() {
+	sorted.resize(packets.size());
+	for (unsigned int i = 0; i < sorted.size(); i++) sorted[i] = i;
+	std::sort(sorted.begin(), sorted.end(), [this](unsigned int a, unsigned int b) {
+		return packets[a].key < packets[b].key;
+	});
+
+	for (unsigned int i : sorted) {
+		const DrawPacket& packet = packets[i];
+		bind(packet);
+
+		if (packet.indexType == 0) {
+			if (packet.instanceCount > 0) glDrawArraysInstanced(GL_TRIANGLES, 0, packet.count, packet.instanceCount);
+			else glDrawArrays(GL_TRIANGLES, 0, packet.count);
+		}
+		else {
+			if (packet.instanceCount > 0) glDrawElementsInstanced(GL_TRIANGLES, packet.count, packet.indexType, 0, packet.instanceCount);
+			else glDrawElements(GL_TRIANGLES, packet.count, packet.indexType, 0);
+		}
+		frameStats.drawCalls++;
+
+		// the frame view has to come back for later draws sharing this program
+		if (packet.hasView) packet.shader->setMat4("view", frame.view);
+	}
+
+	glBindVertexArray(0);
+	if (depthFunc != GL_LESS) glDepthFunc(GL_LESS);
+	packets.clear();
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <glad/glad.h>
+#include <vector>
+#include "shader.h"
+
+enum class RenderLayer : unsigned char {
+	Opaque = 0, // front to back
+	Sky = 1     // after everything opaque, relies on the pos.xyww depth trick
+};
+
+struct DrawPacket {
+	unsigned long long key;
+	Shader* shader;
+	unsigned int VAO;
+	GLenum textureTarget; // 0 when the draw samples nothing
+	unsigned int texture;
+	GLenum depthFunc;
+	GLenum indexType;     // 0 for glDrawArrays
+	GLsizei count;
+	GLsizei instanceCount; // 0 for a plain draw
+	bool hasModel;
+	glm::mat4 model;
+	bool hasColor;
+	glm::vec3 color;
+	bool hasView;         // overrides the frame view, used by the skybox
+	glm::mat4 view;
+};
+
+// per frame values uploaded once per program, the first time it is bound
+struct FrameUniforms {
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec3 lightColor;
+	glm::vec3 lightPos;
+	glm::vec3 viewPos;
+	glm::mat4 lightSpace; // shadow map projection, the map itself is on texture unit 1
+};
+
+struct RenderStats {
+	unsigned int drawCalls;
+	unsigned int programBinds;
+	unsigned int vaoBinds;
+	unsigned int textureBinds;
+	unsigned int depthChanges;
+
+	unsigned int stateChanges() const { return programBinds + vaoBinds + textureBinds + depthChanges; }
+};
+
+class RenderQueue {
+public:
+	static unsigned long long makeKey(RenderLayer layer, float depth, unsigned int program, unsigned int VAO, unsigned int texture);
+	static DrawPacket packet(Shader& shader, unsigned int VAO, GLenum indexType, GLsizei count);
+
+	void begin(const FrameUniforms& frame);
+	void submit(const DrawPacket& packet);
+	// room for this many packets per frame, so submitting does not grow the queue mid-frame
+	void reserve(size_t count);
+	// sorts and executes everything submitted since begin
+	void flush();
+	const RenderStats& stats() const { return frameStats; }
+
+private:
+	FrameUniforms frame;
+	std::vector<DrawPacket> packets;
+	std::vector<unsigned int> sorted;
+	std::vector<unsigned int> framePrograms;
+	RenderStats frameStats;
+
+	unsigned int boundProgram = 0;
+	unsigned int boundVAO = 0;
+	unsigned int boundTexture = 0;
+	GLenum depthFunc = GL_LESS;
+
+	void bind(const DrawPacket& packet);
+};
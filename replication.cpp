@@ -0,0 +1,582 @@
+#include "replication.h"
+#include "physics.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+using namespace physx;
+
+static const unsigned short SnapshotMagic = 0x5350;  // payload
+static const unsigned short FragmentMagic = 0x4650;  // server -> client
+static const unsigned short ControlMagic = 0x4350;   // client -> server
+static const unsigned short ControlHello = 0;
+static const unsigned short ControlAck = 1;
+static const size_t FragmentPayload = 1200;
+static const size_t FragmentHeader = 12;
+static const float PositionScale = 1024.0f;
+static const float ClientTimeout = 5.0f;
+static const float HelloInterval = 0.5f;     // until the first snapshot arrives
+static const float KeepaliveInterval = 1.0f; // re-sent ack while snapshots flow
+static const float StallTimeout = 2.0f;      // no snapshot for this long and the client starts over
+// largest snapshot in fragments, about 4.9 MB of payload: the server won't send more and
+// the client treats a bigger count in a fragment header as a bad packet
+static const unsigned int MaxFragments = 4096;
+// body counts are network input, decoding never allocates for more than this
+static const unsigned int MaxSnapshotBodies = 1u << 20;
+
+// byte writer/reader helpers, little endian
+static void writeU16(std::vector<unsigned char>& out, unsigned int v) {
+	out.push_back((unsigned char)v);
+	out.push_back((unsigned char)(v >> 8));
+}
+
+static void writeU32(std::vector<unsigned char>& out, unsigned int v) {
+	for (int i = 0; i < 4; i++) out.push_back((unsigned char)(v >> (i * 8)));
+}
+
+static void writeVarint(std::vector<unsigned char>& out, unsigned int v) {
+	while (v >= 0x80) {
+		out.push_back((unsigned char)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((unsigned char)v);
+}
+
+static unsigned int zigzag(int v) {
+	return ((unsigned int)v << 1) ^ (unsigned int)(v >> 31);
+}
+
+static int unzigzag(unsigned int v) {
+	return (int)(v >> 1) ^ -(int)(v & 1);
+}
+
+static unsigned int readU16(const unsigned char* p) {
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned int readU32(const unsigned char* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+struct ByteReader {
+	const unsigned char* data;
+	size_t size;
+	size_t offset;
+	bool failed;
+
+	unsigned char byte() {
+		if (offset >= size) { failed = true; return 0; }
+		return data[offset++];
+	}
+
+	unsigned int u32() {
+		if (offset + 4 > size) { failed = true; return 0; }
+		unsigned int v = readU32(data + offset);
+		offset += 4;
+		return v;
+	}
+
+	unsigned int varint() {
+		unsigned int v = 0;
+		for (int shift = 0; shift < 35; shift += 7) {
+			unsigned char b = byte();
+			v |= (unsigned int)(b & 0x7F) << shift;
+			if (!(b & 0x80)) return v;
+		}
+		failed = true;
+		return 0;
+	}
+};
+
+void quantizeBody(const BodyState& body, QuantizedBody& out) {
+	out.kind = body.kind;
+	out.position[0] = (int)lrintf(body.position.x * PositionScale);
+	out.position[1] = (int)lrintf(body.position.y * PositionScale);
+	out.position[2] = (int)lrintf(body.position.z * PositionScale);
+
+	// drop the largest component, the other three fit in [-1/sqrt2, 1/sqrt2]
+	float q[4] = { body.rotation.x, body.rotation.y, body.rotation.z, body.rotation.w };
+	unsigned int largest = 0;
+	for (unsigned int i = 1; i < 4; i++) {
+		if (fabsf(q[i]) > fabsf(q[largest])) largest = i;
+	}
+	float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+
+	unsigned int packed = largest << 30;
+	unsigned int shift = 20;
+	for (unsigned int i = 0; i < 4; i++) {
+		if (i == largest) continue;
+		float v = q[i] * sign * 1.41421356f; // -> [-1, 1]
+		v = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+		packed |= (unsigned int)lrintf((v * 0.5f + 0.5f) * 1023.0f) << shift;
+		shift -= 10;
+	}
+	out.rotation = packed;
+}
+
+void dequantizeBody(const QuantizedBody& body, BodyState& out) {
+	out.kind = body.kind;
+	out.position = PxVec3(body.position[0] / PositionScale, body.position[1] / PositionScale, body.position[2] / PositionScale);
+
+	unsigned int largest = body.rotation >> 30;
+	float q[4];
+	float sum = 0.0f;
+	unsigned int shift = 20;
+	for (unsigned int i = 0; i < 4; i++) {
+		if (i == largest) continue;
+		float v = ((body.rotation >> shift) & 0x3FF) / 1023.0f;
+		q[i] = (v * 2.0f - 1.0f) / 1.41421356f;
+		sum += q[i] * q[i];
+		shift -= 10;
+	}
+	q[largest] = sqrtf(PxMax(1.0f - sum, 0.0f));
+	out.rotation = PxQuat(q[0], q[1], q[2], q[3]).getNormalized();
+}
+
+void encodeSnapshot(const std::vector<QuantizedBody>& bodies, const std::vector<QuantizedBody>* baseline,
+	const SnapshotHeader& header, std::vector<unsigned char>& out) {
+	out.clear();
+	writeU16(out, SnapshotMagic);
+	writeU32(out, header.sequence);
+	writeU32(out, baseline ? header.baseline : NoBaseline);
+	unsigned int time;
+	memcpy(&time, &header.serverTime, sizeof(time));
+	writeU32(out, time);
+	unsigned int count = (unsigned int)bodies.size();
+	writeVarint(out, count);
+
+	// gap to the next changed body, then a flag byte and the changed fields
+	unsigned int next = 0;
+	for (unsigned int id = 0; id < count; id++) {
+		const QuantizedBody& body = bodies[id];
+		const QuantizedBody* base = baseline && id < baseline->size() ? &(*baseline)[id] : nullptr;
+
+		bool kindChanged = !base || base->kind != body.kind;
+		bool positionChanged = !base || memcmp(base->position, body.position, sizeof(body.position)) != 0;
+		bool rotationChanged = !base || base->rotation != body.rotation;
+		if (!kindChanged && !positionChanged && !rotationChanged) continue;
+
+		writeVarint(out, id - next);
+		next = id + 1;
+		out.push_back((unsigned char)((positionChanged ? 1 : 0) | (rotationChanged ? 2 : 0) | (kindChanged ? 4 : 0)));
+		if (kindChanged) out.push_back(body.kind);
+		if (positionChanged) {
+			for (int axis = 0; axis < 3; axis++) {
+				writeVarint(out, zigzag(body.position[axis] - (base ? base->position[axis] : 0)));
+			}
+		}
+		if (rotationChanged) writeU32(out, body.rotation);
+	}
+	// a gap past the end terminates the list
+	writeVarint(out, count - next);
+}
+
+bool readSnapshotHeader(const unsigned char* data, size_t size, SnapshotHeader& header) {
+	if (size < 14 || readU16(data) != SnapshotMagic) return false;
+	ByteReader reader = { data, size, 2, false };
+	header.sequence = reader.u32();
+	header.baseline = reader.u32();
+	unsigned int time = reader.u32();
+	memcpy(&header.serverTime, &time, sizeof(time));
+	header.bodyCount = reader.varint();
+	return !reader.failed && header.bodyCount <= MaxSnapshotBodies;
+}
+
+bool decodeSnapshot(const unsigned char* data, size_t size, const std::vector<QuantizedBody>* baseline,
+	std::vector<QuantizedBody>& bodies) {
+	SnapshotHeader header;
+	if (!readSnapshotHeader(data, size, header)) return false;
+	if (header.baseline != NoBaseline && !baseline) return false;
+
+	ByteReader reader = { data, size, 14, false };
+	reader.varint(); // body count, already in the header
+
+	QuantizedBody empty = {};
+	if (header.baseline != NoBaseline) {
+		bodies.assign(baseline->begin(), baseline->begin() + PxMin((size_t)header.bodyCount, baseline->size()));
+	}
+	else {
+		bodies.clear();
+	}
+	bodies.resize(header.bodyCount, empty);
+
+	unsigned int next = 0;
+	for (;;) {
+		unsigned int id = next + reader.varint();
+		if (reader.failed) return false;
+		if (id >= header.bodyCount) break;
+		next = id + 1;
+
+		QuantizedBody& body = bodies[id];
+		unsigned char flags = reader.byte();
+		if (flags & 4) body.kind = reader.byte();
+		if (flags & 1) {
+			for (int axis = 0; axis < 3; axis++) body.position[axis] += unzigzag(reader.varint());
+		}
+		if (flags & 2) body.rotation = reader.u32();
+	}
+	return !reader.failed;
+}
+
+std::vector<QuantizedBody>& SnapshotHistory::store(unsigned int sequence) {
+	unsigned int slot = sequence % Size;
+	sequences[slot] = sequence;
+	valid[slot] = true;
+	return snapshots[slot];
+}
+
+void SnapshotHistory::clear() {
+	for (unsigned int i = 0; i < Size; i++) valid[i] = false;
+}
+
+const std::vector<QuantizedBody>* SnapshotHistory::find(unsigned int sequence) const {
+	unsigned int slot = sequence % Size;
+	if (!valid[slot] || sequences[slot] != sequence) return nullptr;
+	return &snapshots[slot];
+}
+
+bool ReplicationServer::start(unsigned short port) {
+	return socket.open(port);
+}
+
+void ReplicationServer::stop() {
+	socket.close();
+	clients.clear();
+}
+
+void ReplicationServer::poll(float time) {
+	unsigned char packet[64];
+	NetAddress from;
+	int size;
+	while ((size = socket.receive(packet, sizeof(packet), from)) >= 0) {
+		if (size < 8 || readU16(packet) != ControlMagic) continue;
+		unsigned int type = readU16(packet + 2);
+		unsigned int value = readU32(packet + 4);
+
+		Client* client = nullptr;
+		for (Client& c : clients) {
+			if (c.address == from) client = &c;
+		}
+		if (!client) {
+			if (type != ControlHello) continue;
+			clients.push_back(Client{ from, NoBaseline, time });
+			client = &clients.back();
+		}
+
+		client->lastHeard = time;
+		// a hello from a known client means it lost its baselines, the next snapshot is full
+		if (type == ControlHello) client->acked = NoBaseline;
+		// only snapshots this server actually sent can become a baseline
+		bool sent = value != 0 && value <= sequence;
+		if (type == ControlAck && sent && (client->acked == NoBaseline || value > client->acked)) client->acked = value;
+	}
+
+	for (size_t i = 0; i < clients.size();) {
+		if (time - clients[i].lastHeard > ClientTimeout) {
+			clients[i] = clients.back();
+			clients.pop_back();
+		}
+		else {
+			i++;
+		}
+	}
+}
+
+void ReplicationServer::broadcast(const std::vector<BodyState>& bodies, float serverTime) {
+	sequence++;
+	std::vector<QuantizedBody>& snapshot = history.store(sequence);
+	snapshot.resize(bodies.size());
+	for (size_t i = 0; i < bodies.size(); i++) quantizeBody(bodies[i], snapshot[i]);
+
+	unsigned char packet[FragmentHeader + FragmentPayload];
+	for (Client& client : clients) {
+		const std::vector<QuantizedBody>* baseline = client.acked != NoBaseline ? history.find(client.acked) : nullptr;
+
+		SnapshotHeader header;
+		header.sequence = sequence;
+		header.baseline = client.acked;
+		header.serverTime = serverTime;
+		header.bodyCount = (unsigned int)bodies.size();
+		encodeSnapshot(snapshot, baseline, header, payload);
+		lastBytes = payload.size();
+
+		// clients drop anything over MaxFragments, sending it would only waste the bandwidth
+		unsigned int fragments = (unsigned int)((payload.size() + FragmentPayload - 1) / FragmentPayload);
+		if (fragments > MaxFragments) {
+			if (oversized++ == 0) {
+				fprintf(stderr, "snapshot %u needs %u fragments (limit %u), oversized snapshots are not sent\n",
+					sequence, fragments, MaxFragments);
+			}
+			continue;
+		}
+		for (unsigned int f = 0; f < fragments; f++) {
+			size_t offset = f * FragmentPayload;
+			size_t chunk = PxMin(FragmentPayload, payload.size() - offset);
+			packet[0] = (unsigned char)FragmentMagic; packet[1] = (unsigned char)(FragmentMagic >> 8);
+			packet[2] = (unsigned char)f; packet[3] = (unsigned char)(f >> 8);
+			packet[4] = (unsigned char)fragments; packet[5] = (unsigned char)(fragments >> 8);
+			packet[6] = 0; packet[7] = 0;
+			for (int i = 0; i < 4; i++) packet[8 + i] = (unsigned char)(sequence >> (i * 8));
+			memcpy(packet + FragmentHeader, payload.data() + offset, chunk);
+			socket.sendTo(client.address, packet, (int)(FragmentHeader + chunk));
+		}
+	}
+}
+
+bool ReplicationClient::connect(const NetAddress& serverAddress) {
+	server = serverAddress;
+	return socket.open(0);
+}
+
+void ReplicationClient::reset() {
+	history.clear();
+	assembling = false;
+	haveSnapshot = false;
+	newestSequence = 0;
+	received = 0;
+}
+
+void ReplicationClient::poll(float localTime) {
+	// the server dropped us or restarted with lower sequences, ask for a full snapshot again
+	if (haveSnapshot && localTime - lastSnapshotTime > StallTimeout) reset();
+
+	// hellos until snapshots flow, then the last ack again so the server keeps us through lost packets
+	if (localTime - lastHello > (haveSnapshot ? KeepaliveInterval : HelloInterval)) {
+		unsigned char control[8] = {};
+		control[0] = (unsigned char)ControlMagic; control[1] = (unsigned char)(ControlMagic >> 8);
+		control[2] = (unsigned char)(haveSnapshot ? ControlAck : ControlHello);
+		if (haveSnapshot) {
+			for (int i = 0; i < 4; i++) control[4 + i] = (unsigned char)(newestSequence >> (i * 8));
+		}
+		socket.sendTo(server, control, sizeof(control));
+		lastHello = localTime;
+	}
+
+	unsigned char packet[FragmentHeader + FragmentPayload];
+	NetAddress from;
+	int size;
+	while ((size = socket.receive(packet, sizeof(packet), from)) >= 0) {
+		if (!(from == server) || size < (int)FragmentHeader || readU16(packet) != FragmentMagic) continue;
+		unsigned int index = readU16(packet + 2);
+		unsigned int count = readU16(packet + 4);
+		unsigned int sequence = readU32(packet + 8);
+		if (count == 0 || count > MaxFragments || index >= count) continue;
+		if (haveSnapshot && sequence <= newestSequence) continue;
+		if (assembling && sequence < assemblySequence) continue;
+
+		// every fragment but the last is full, so offsets stay index * FragmentPayload
+		size_t chunk = size - FragmentHeader;
+		if (chunk > FragmentPayload || (index < count - 1 && chunk != FragmentPayload)) continue;
+
+		if (!assembling || sequence > assemblySequence) {
+			// a newer snapshot started, whatever was half received is stale now
+			assembling = true;
+			assemblySequence = sequence;
+			assemblyCount = count;
+			assembly.resize(count * FragmentPayload);
+			fragmentsReceived.assign(count, false);
+			fragmentsLeft = count;
+			assemblySize = 0;
+		}
+		// the first fragment seen fixed the buffer sizes, disagreeing ones are dropped
+		if (count != assemblyCount || fragmentsReceived[index]) continue;
+
+		memcpy(assembly.data() + index * FragmentPayload, packet + FragmentHeader, chunk);
+		fragmentsReceived[index] = true;
+		if (index == count - 1) assemblySize = index * FragmentPayload + chunk;
+		if (--fragmentsLeft == 0) {
+			assembling = false;
+			complete(localTime);
+		}
+	}
+}
+
+void ReplicationClient::complete(float localTime) {
+	SnapshotHeader header;
+	if (!readSnapshotHeader(assembly.data(), assemblySize, header)) return;
+	const std::vector<QuantizedBody>* baseline = header.baseline != NoBaseline ? history.find(header.baseline) : nullptr;
+	if (!decodeSnapshot(assembly.data(), assemblySize, baseline, decoded)) return;
+
+	history.store(header.sequence) = decoded;
+	newestSequence = header.sequence;
+	haveSnapshot = true;
+	lastSnapshotTime = localTime;
+	lastBytes = assemblySize;
+
+	unsigned char ack[8] = {};
+	ack[0] = (unsigned char)ControlMagic; ack[1] = (unsigned char)(ControlMagic >> 8);
+	ack[2] = (unsigned char)ControlAck;
+	for (int i = 0; i < 4; i++) ack[4 + i] = (unsigned char)(header.sequence >> (i * 8));
+	socket.sendTo(server, ack, sizeof(ack));
+
+	Received& slot = buffer[received % BufferedSnapshots];
+	slot.serverTime = header.serverTime;
+	slot.bodies.resize(decoded.size());
+	for (size_t i = 0; i < decoded.size(); i++) dequantizeBody(decoded[i], slot.bodies[i]);
+
+	float offset = header.serverTime - localTime;
+	clockOffset = received == 0 ? offset : clockOffset + (offset - clockOffset) * 0.1f;
+	received++;
+}
+
+bool ReplicationClient::sample(float localTime, std::vector<BodyState>& bodies) {
+	if (received < 2) return false;
+
+	float renderTime = localTime + clockOffset - interpolationDelay;
+	unsigned int available = received < BufferedSnapshots ? received : BufferedSnapshots;
+	unsigned int oldest = received - available;
+
+	// newest snapshot at or before renderTime, and the one after it
+	unsigned int a = oldest;
+	for (unsigned int i = oldest; i < received; i++) {
+		if (buffer[i % BufferedSnapshots].serverTime <= renderTime) a = i;
+	}
+	unsigned int b = a + 1 < received ? a + 1 : a;
+	const Received& from = buffer[a % BufferedSnapshots];
+	const Received& to = buffer[b % BufferedSnapshots];
+
+	float span = to.serverTime - from.serverTime;
+	float t = span > 0.0f ? (renderTime - from.serverTime) / span : 1.0f;
+	t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+
+	bodies.resize(to.bodies.size());
+	for (size_t i = 0; i < to.bodies.size(); i++) {
+		const BodyState& next = to.bodies[i];
+		if (i >= from.bodies.size()) {
+			bodies[i] = next;
+			continue;
+		}
+		const BodyState& prev = from.bodies[i];
+		PxQuat target = prev.rotation.dot(next.rotation) < 0.0f ? -next.rotation : next.rotation;
+		bodies[i].kind = next.kind;
+		bodies[i].position = prev.position + (next.position - prev.position) * t;
+		bodies[i].rotation = (prev.rotation * (1.0f - t) + target * t).getNormalized();
+	}
+	return true;
+}
+
+int runReplicationServer(unsigned short port, const std::atomic<bool>& stop) {
+	if (!netStartup()) return -4;
+	initPhysX();
+
+	ReplicationServer server;
+	if (!server.start(port)) {
+		netShutdown();
+		return -5;
+	}
+
+	std::vector<PxRigidDynamic*> bodies;
+	std::vector<unsigned char> kinds;
+	for (int k = 0; k < 10; k++) {
+		for (int i = 0; i < 10; i++) {
+			for (int j = 0; j < 10; j++) {
+				bodies.push_back(createPxCube(PxVec3(i * 1.f, 0.1f + k * 1.05f, j * 1.f), PxVec3(0.5f, 0.5f, 0.5f)));
+				kinds.push_back(BodyKindCube);
+			}
+		}
+	}
+
+	const float timeStep = 1.0f / 60.0f;
+	const int stepsPerSnapshot = 3; // 20 Hz
+	std::vector<BodyState> states;
+	auto start = std::chrono::steady_clock::now();
+	auto nextStep = start;
+	unsigned int seed = 1;
+
+	for (unsigned int step = 0; !stop.load(std::memory_order_relaxed); step++) {
+		float time = step * timeStep;
+		server.poll(time);
+
+		// keep something moving for the clients to watch
+		if (step % 120 == 0) {
+			seed = seed * 1664525u + 1013904223u;
+			float angle = (seed >> 8) / (float)(1 << 24) * PxTwoPi;
+			PxVec3 from(4.5f + cosf(angle) * 20.0f, 3.0f, 4.5f + sinf(angle) * 20.0f);
+			PxRigidDynamic* sphere = createPxSphere(from, 1.0f);
+			sphere->setLinearVelocity((PxVec3(4.5f, 3.0f, 4.5f) - from).getNormalized() * 25.0f);
+			bodies.push_back(sphere);
+			kinds.push_back(BodyKindSphere);
+		}
+
+		gScene->simulate(timeStep);
+		gScene->fetchResults(true);
+
+		if (step % stepsPerSnapshot == 0 && server.clientCount() > 0) {
+			states.resize(bodies.size());
+			for (size_t i = 0; i < bodies.size(); i++) {
+				PxTransform pose = bodies[i]->getGlobalPose();
+				states[i].kind = kinds[i];
+				states[i].position = pose.p;
+				states[i].rotation = pose.q;
+			}
+			server.broadcast(states, time);
+		}
+
+		nextStep += std::chrono::microseconds(16667);
+		std::this_thread::sleep_until(nextStep);
+	}
+
+	if (server.oversizedSnapshots() > 0) fprintf(stderr, "%zu oversized snapshot(s) were not sent\n", server.oversizedSnapshots());
+	server.stop();
+	for (PxRigidDynamic* body : bodies) body->release();
+	netShutdown();
+	return 0;
+}
+
+void runReplicationBenchmark(FILE* out) {
+	const unsigned int bodyCounts[] = { 1000, 100000 };
+	const int frames = 20;
+	const float movingFraction = 0.1f;
+
+	fprintf(out, "replication benchmark, %d snapshots per count, %.0f%% of bodies moving\n", frames, movingFraction * 100.0f);
+
+	for (unsigned int count : bodyCounts) {
+		std::vector<BodyState> states(count);
+		unsigned int side = (unsigned int)ceilf(cbrtf((float)count));
+		for (unsigned int i = 0; i < count; i++) {
+			states[i].kind = (unsigned char)(i % 50 == 0 ? BodyKindSphere : BodyKindCube);
+			states[i].position = PxVec3((float)(i % side), 0.5f + (float)((i / side) % side) * 1.05f, (float)(i / (side * side)));
+			states[i].rotation = PxQuat(PxIdentity);
+		}
+
+		std::vector<QuantizedBody> previous(count), current(count), decoded;
+		for (unsigned int i = 0; i < count; i++) quantizeBody(states[i], previous[i]);
+		std::vector<unsigned char> full, delta;
+		double encodeMs = 0.0, decodeMs = 0.0;
+		size_t fullBytes = 0, deltaBytes = 0;
+		unsigned int seed = 7;
+
+		for (int f = 0; f < frames; f++) {
+			for (unsigned int m = 0; m < (unsigned int)(count * movingFraction); m++) {
+				seed = seed * 1664525u + 1013904223u;
+				BodyState& body = states[seed % count];
+				body.position += PxVec3(0.01f, -0.02f, 0.015f);
+				body.rotation = (body.rotation * PxQuat(0.05f, PxVec3(0.0f, 1.0f, 0.0f))).getNormalized();
+			}
+
+			SnapshotHeader header = { (unsigned int)f + 2, (unsigned int)f + 1, f / 20.0f, count };
+			auto t0 = std::chrono::high_resolution_clock::now();
+			for (unsigned int i = 0; i < count; i++) quantizeBody(states[i], current[i]);
+			encodeSnapshot(current, &previous, header, delta);
+			auto t1 = std::chrono::high_resolution_clock::now();
+			decodeSnapshot(delta.data(), delta.size(), &previous, decoded);
+			auto t2 = std::chrono::high_resolution_clock::now();
+
+			encodeSnapshot(current, nullptr, header, full);
+			encodeMs += std::chrono::duration<double, std::milli>(t1 - t0).count();
+			decodeMs += std::chrono::duration<double, std::milli>(t2 - t1).count();
+			fullBytes += full.size();
+			deltaBytes += delta.size();
+
+			if (decoded.size() != current.size() || memcmp(decoded.data(), current.data(), current.size() * sizeof(QuantizedBody)) != 0) {
+				fprintf(out, "bodies %6u  decode mismatch at snapshot %d\n", count, f);
+			}
+			previous.swap(current);
+		}
+
+		fprintf(out, "bodies %6u  full %9zu bytes  delta %9zu bytes  encode %7.3f ms  decode %7.3f ms\n",
+			count, fullBytes / frames, deltaBytes / frames, encodeMs / frames, decodeMs / frames);
+		fflush(out);
+	}
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include <PxPhysicsAPI.h>
+#include <atomic>
+#include <cstdio>
+#include <vector>
+#include "net.h"
+
+// pose of one replicated body, ids are positions in the snapshot array
+struct BodyState {
+	unsigned char kind; // BodyKind
+	physx::PxVec3 position;
+	physx::PxQuat rotation;
+};
+
+// 1/1024 m positions and a smallest-three 2:10:10:10 rotation
+struct QuantizedBody {
+	int position[3];
+	unsigned int rotation;
+	unsigned char kind;
+};
+
+struct SnapshotHeader {
+	unsigned int sequence;
+	unsigned int baseline; // NoBaseline when the snapshot is self contained
+	float serverTime;
+	unsigned int bodyCount;
+};
+
+static const unsigned int NoBaseline = 0xFFFFFFFF;
+static const unsigned short DefaultReplicationPort = 27015;
+
+void quantizeBody(const BodyState& body, QuantizedBody& out);
+void dequantizeBody(const QuantizedBody& body, BodyState& out);
+
+// only bodies that differ from the baseline are written, as varint deltas
+void encodeSnapshot(const std::vector<QuantizedBody>& bodies, const std::vector<QuantizedBody>* baseline,
+	const SnapshotHeader& header, std::vector<unsigned char>& out);
+bool readSnapshotHeader(const unsigned char* data, size_t size, SnapshotHeader& header);
+bool decodeSnapshot(const unsigned char* data, size_t size, const std::vector<QuantizedBody>* baseline,
+	std::vector<QuantizedBody>& bodies);
+
+// last few snapshots by sequence, used as delta baselines on both ends
+class SnapshotHistory {
+public:
+	static const unsigned int Size = 64;
+
+	std::vector<QuantizedBody>& store(unsigned int sequence);
+	const std::vector<QuantizedBody>* find(unsigned int sequence) const;
+	void clear();
+
+private:
+	std::vector<QuantizedBody> snapshots[Size];
+	unsigned int sequences[Size] = {};
+	bool valid[Size] = {};
+};
+
+class ReplicationServer {
+public:
+	bool start(unsigned short port);
+	// closes the socket and forgets every client
+	void stop();
+	// takes hellos and acks
+	void poll(float time);
+	void broadcast(const std::vector<BodyState>& bodies, float serverTime);
+
+	size_t clientCount() const { return clients.size(); }
+	size_t lastSnapshotBytes() const { return lastBytes; }
+	// per client sends skipped because the snapshot needed more fragments than a client accepts
+	size_t oversizedSnapshots() const { return oversized; }
+
+private:
+	struct Client {
+		NetAddress address;
+		unsigned int acked;
+		float lastHeard;
+	};
+
+	UdpSocket socket;
+	std::vector<Client> clients;
+	SnapshotHistory history;
+	unsigned int sequence = 0;
+	std::vector<unsigned char> payload;
+	size_t lastBytes = 0;
+	size_t oversized = 0;
+};
+
+class ReplicationClient {
+public:
+	float interpolationDelay = 0.1f; // seconds behind the newest snapshot
+
+	bool connect(const NetAddress& server);
+	void poll(float localTime);
+	// interpolated bodies for this frame, false until two snapshots are in
+	bool sample(float localTime, std::vector<BodyState>& bodies);
+
+	size_t lastSnapshotBytes() const { return lastBytes; }
+
+private:
+	struct Received {
+		float serverTime;
+		std::vector<BodyState> bodies;
+	};
+
+	UdpSocket socket;
+	NetAddress server;
+	SnapshotHistory history;
+	std::vector<QuantizedBody> decoded;
+
+	// fragments of the snapshot being reassembled, older ones are dropped
+	unsigned int assemblySequence = 0;
+	unsigned int assemblyCount = 0;
+	bool assembling = false;
+	std::vector<unsigned char> assembly;
+	std::vector<bool> fragmentsReceived;
+	unsigned int fragmentsLeft = 0;
+	size_t assemblySize = 0;
+
+	static const unsigned int BufferedSnapshots = 8;
+	Received buffer[BufferedSnapshots];
+	unsigned int received = 0;
+	unsigned int newestSequence = 0;
+	bool haveSnapshot = false;
+	float clockOffset = 0.0f;
+	float lastHello = -1.0f; // last hello or keepalive sent
+	float lastSnapshotTime = 0.0f;
+	size_t lastBytes = 0;
+
+	void complete(float localTime);
+	void reset();
+};
+
+// headless authoritative server: simulates gScene and streams it until stop is set,
+// then closes the socket and shuts the network down
+int runReplicationServer(unsigned short port, const std::atomic<bool>& stop);
+// bytes per snapshot and encode/decode cost at 1k and 100k bodies, written to out
+void runReplicationBenchmark(FILE* out);
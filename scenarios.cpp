@@ -0,0 +1,270 @@
+#include <windows.h>
+#include <psapi.h>
+#include "scenarios.h"
+#include "physics.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#pragma comment(lib, "psapi.lib")
+
+using namespace physx;
+
+static const double regressionThreshold = 0.10; // fraction over the baseline that fails
+static const double timeSlackMs = 0.05;         // below this a difference is timer noise
+static const double spikeSlackMs = 0.5;         // same for the worst step, a single frame is noisier
+static const double memorySlackKB = 1024.0;
+
+float ScenarioWorld::random() {
+	seed = seed * 1664525u + 1013904223u;
+	return (seed >> 8) / (float)(1 << 24);
+}
+
+void ScenarioWorld::release() {
+	for (Cube& body : bodies) body.pxRigidBody->release();
+	for (PxRigidActor* actor : statics) actor->release();
+	bodies.clear();
+	statics.clear();
+}
+
+static void addCube(ScenarioWorld& world, const PxVec3& position, const PxVec3& halfExtents) {
+	Cube cube;
+	cube.Scale = glm::vec3(halfExtents.x, halfExtents.y, halfExtents.z) * 2.0f;
+	cube.Material = 0; // headless, never drawn
+	cube.pxRigidBody = createPxCube(position, halfExtents);
+	world.bodies.push_back(cube);
+}
+
+static PxRigidDynamic* addSphere(ScenarioWorld& world, const PxVec3& position, float radius) {
+	Cube sphere;
+	sphere.Scale = glm::vec3(radius);
+	sphere.Material = 0;
+	sphere.pxRigidBody = createPxSphere(position, radius);
+	world.bodies.push_back(sphere);
+	return sphere.pxRigidBody;
+}
+
+// 4x4 single cube columns, size high, each block nudged a little so they topple
+static void buildTowers(const ScenarioParams& params, ScenarioWorld& world) {
+	for (int t = 0; t < 16; t++) {
+		float x = (t % 4) * 4.0f;
+		float z = (t / 4) * 4.0f;
+		for (unsigned int k = 0; k < params.size; k++) {
+			PxVec3 jitter((world.random() - 0.5f) * 0.1f, 0.0f, (world.random() - 0.5f) * 0.1f);
+			addCube(world, PxVec3(x, 0.5f + k * 1.01f, z) + jitter, PxVec3(0.5f));
+		}
+	}
+}
+
+// square layers shrinking by one cube per side, size is the base width
+static void buildPyramid(const ScenarioParams& params, ScenarioWorld& world) {
+	for (unsigned int k = 0; k < params.size; k++) {
+		unsigned int width = params.size - k;
+		float offset = k * 0.5f;
+		for (unsigned int i = 0; i < width; i++) {
+			for (unsigned int j = 0; j < width; j++) {
+				addCube(world, PxVec3(offset + i * 1.0f, 0.5f + k * 1.01f, offset + j * 1.0f), PxVec3(0.5f));
+			}
+		}
+	}
+}
+
+// size dominoes along a wandering path, the first one is tipped over
+static void buildDominoes(const ScenarioParams& params, ScenarioWorld& world) {
+	const PxVec3 halfExtents(0.1f, 1.0f, 0.5f);
+	PxVec3 position(0.0f, halfExtents.y + 0.01f, 0.0f);
+	float heading = 0.0f;
+	for (unsigned int i = 0; i < params.size; i++) {
+		addCube(world, position, halfExtents);
+		PxRigidDynamic* body = world.bodies.back().pxRigidBody;
+		body->setGlobalPose(PxTransform(position, PxQuat(-heading, PxVec3(0.0f, 1.0f, 0.0f))));
+
+		PxVec3 forward(cosf(heading), 0.0f, sinf(heading));
+		if (i == 0) body->setAngularVelocity(PxVec3(0.0f, 1.0f, 0.0f).cross(forward) * 2.0f);
+		position += forward * 1.0f;
+		heading += (world.random() - 0.5f) * 0.3f;
+	}
+}
+
+// size bodies (a fifth of them spheres) rained onto a tilted ramp
+static void buildAvalanche(const ScenarioParams& params, ScenarioWorld& world) {
+	PxTransform rampPose(PxVec3(0.0f, 9.0f, 0.0f), PxQuat(0.4f, PxVec3(1.0f, 0.0f, 0.0f)));
+	PxRigidStatic* ramp = PxCreateStatic(*gPhysics, rampPose, PxBoxGeometry(12.0f, 0.5f, 20.0f), *gMaterial);
+	PxShape* shape = nullptr;
+	ramp->getShapes(&shape, 1);
+	shape->setSimulationFilterData(PxFilterData(BodyKindGround, 0, 0, 0));
+	gScene->addActor(*ramp);
+	world.statics.push_back(ramp);
+
+	for (unsigned int i = 0; i < params.size; i++) {
+		PxVec3 position(-10.0f + world.random() * 20.0f, 20.0f + world.random() * 20.0f, -15.0f + world.random() * 10.0f);
+		if (i % 5 == 0) addSphere(world, position, 0.5f);
+		else addCube(world, position, PxVec3(0.5f));
+	}
+}
+
+// the demo stack, shot at from a ring of positions for the whole run
+static void buildBarrage(const ScenarioParams&, ScenarioWorld& world) {
+	for (int k = 0; k < 10; k++) {
+		for (int i = 0; i < 10; i++) {
+			for (int j = 0; j < 10; j++) {
+				addCube(world, PxVec3(i * 1.f, 0.1f + k * 1.05f, j * 1.f), PxVec3(0.5f));
+			}
+		}
+	}
+}
+
+static void tickBarrage(int step, ScenarioWorld& world) {
+	if (step % 6 != 0) return;
+	float angle = world.random() * PxTwoPi;
+	PxVec3 from(4.5f + cosf(angle) * 25.0f, 2.0f + world.random() * 6.0f, 4.5f + sinf(angle) * 25.0f);
+	PxVec3 target(world.random() * 9.0f, world.random() * 10.0f, world.random() * 9.0f);
+	addSphere(world, from, 1.0f)->setLinearVelocity((target - from).getNormalized() * 25.0f);
+}
+
+const Scenario scenarioLibrary[] = {
+	{ "towers", { 11, 40, 600 }, buildTowers, nullptr },
+	{ "pyramid", { 12, 14, 600 }, buildPyramid, nullptr },
+	{ "dominoes", { 13, 500, 900 }, buildDominoes, nullptr },
+	{ "avalanche", { 14, 1500, 600 }, buildAvalanche, nullptr },
+	{ "barrage", { 15, 0, 1200 }, buildBarrage, tickBarrage },
+};
+const size_t scenarioCount = sizeof(scenarioLibrary) / sizeof(scenarioLibrary[0]);
+
+struct ScenarioResult {
+	char name[32];
+	double stepMs;
+	double maxStepMs;
+	double prepMs;
+	double memoryKB; // growth of private memory while the scenario was loaded
+};
+
+static double privateMemoryKB() {
+	PROCESS_MEMORY_COUNTERS_EX counters = {};
+	GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&counters, sizeof(counters));
+	return counters.PrivateUsage / 1024.0;
+}
+
+static std::vector<ScenarioResult> loadBaselines(const char* path) {
+	std::vector<ScenarioResult> baselines;
+	FILE* file = nullptr;
+	if (fopen_s(&file, path, "r") != 0 || !file) return baselines;
+
+	// one scenario per line, # starts a comment line
+	char line[256];
+	ScenarioResult entry;
+	while (fgets(line, sizeof(line), file)) {
+		if (line[0] == '#') continue;
+		if (sscanf_s(line, "%31s %lf %lf %lf %lf", entry.name, (unsigned int)sizeof(entry.name),
+			&entry.stepMs, &entry.maxStepMs, &entry.prepMs, &entry.memoryKB) == 5) {
+			baselines.push_back(entry);
+		}
+	}
+	fclose(file);
+	return baselines;
+}
+
+static bool regressed(double current, double baseline, double slack) {
+	return current > baseline * (1.0 + regressionThreshold) && current - baseline > slack;
+}
+
+static double percent(double current, double baseline) {
+	return baseline > 0.0 ? (current / baseline - 1.0) * 100.0 : 0.0;
+}
+
+int runScenarioSuite(FILE* out, const char* baselinePath, bool updateBaselines) {
+	std::vector<ScenarioResult> baselines;
+	if (!updateBaselines) baselines = loadBaselines(baselinePath);
+	std::vector<ScenarioResult> recorded;
+	int regressions = 0;
+	int missing = 0;
+
+	fprintf(out, "scenario benchmark, baselines %s, threshold %.0f%%\n", baselinePath, regressionThreshold * 100.0);
+
+	std::vector<InstanceData> models;
+	for (size_t s = 0; s < scenarioCount; s++) {
+		const Scenario& scenario = scenarioLibrary[s];
+		double memoryBeforeKB = privateMemoryKB();
+		ScenarioWorld world;
+		world.seed = scenario.params.seed;
+		scenario.build(scenario.params, world);
+
+		double stepMs = 0.0, maxStepMs = 0.0, prepMs = 0.0;
+		for (int step = 0; step < scenario.params.steps; step++) {
+			if (scenario.tick) scenario.tick(step, world);
+
+			auto t0 = std::chrono::high_resolution_clock::now();
+			gScene->simulate(1.0f / 60.0f);
+			gScene->fetchResults(true);
+			auto t1 = std::chrono::high_resolution_clock::now();
+
+			// the per frame pose to instance data work the renderer does
+			models.clear();
+			for (const Cube& body : world.bodies) models.push_back(InstanceData{ GetCubeModel(body), body.Material });
+			auto t2 = std::chrono::high_resolution_clock::now();
+
+			double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+			stepMs += ms;
+			if (ms > maxStepMs) maxStepMs = ms;
+			prepMs += std::chrono::duration<double, std::milli>(t2 - t1).count();
+		}
+
+		// measured before the release, memory a previous scenario gave back may be reused here
+		ScenarioResult result;
+		strncpy_s(result.name, scenario.name, _TRUNCATE);
+		result.stepMs = stepMs / scenario.params.steps;
+		result.maxStepMs = maxStepMs;
+		result.prepMs = prepMs / scenario.params.steps;
+		result.memoryKB = privateMemoryKB() - memoryBeforeKB;
+		size_t bodyCount = world.bodies.size();
+		world.release();
+
+		const ScenarioResult* baseline = nullptr;
+		for (const ScenarioResult& entry : baselines) {
+			if (strcmp(entry.name, result.name) == 0) baseline = &entry;
+		}
+
+		fprintf(out, "%-10s bodies %5zu  step %7.3f ms (max %7.3f)  prep %6.3f ms  memory %+8.0f KB  ",
+			result.name, bodyCount, result.stepMs, result.maxStepMs, result.prepMs, result.memoryKB);
+		if (updateBaselines) {
+			fprintf(out, "recorded\n");
+			recorded.push_back(result);
+			continue;
+		}
+		if (!baseline) {
+			fprintf(out, "MISSING baseline\n");
+			missing++;
+			continue;
+		}
+
+		bool stepBad = regressed(result.stepMs, baseline->stepMs, timeSlackMs);
+		bool spikeBad = regressed(result.maxStepMs, baseline->maxStepMs, spikeSlackMs);
+		bool prepBad = regressed(result.prepMs, baseline->prepMs, timeSlackMs);
+		bool memoryBad = regressed(result.memoryKB, baseline->memoryKB, memorySlackKB);
+		if (stepBad || spikeBad || prepBad || memoryBad) {
+			regressions++;
+			fprintf(out, "REGRESSION step %+.1f%% max %+.1f%% prep %+.1f%% memory %+.1f%%\n",
+				percent(result.stepMs, baseline->stepMs), percent(result.maxStepMs, baseline->maxStepMs),
+				percent(result.prepMs, baseline->prepMs), percent(result.memoryKB, baseline->memoryKB));
+		}
+		else {
+			fprintf(out, "ok\n");
+		}
+		fflush(out);
+	}
+
+	if (updateBaselines) {
+		FILE* file = nullptr;
+		if (fopen_s(&file, baselinePath, "w") == 0 && file) {
+			fprintf(file, "# scenario stepMs maxStepMs prepMs memoryKB\n");
+			for (const ScenarioResult& entry : recorded) {
+				fprintf(file, "%s %.4f %.4f %.4f %.0f\n", entry.name, entry.stepMs, entry.maxStepMs, entry.prepMs, entry.memoryKB);
+			}
+			fclose(file);
+		}
+	}
+
+	fprintf(out, "%d regression(s), %d scenario(s) without a baseline\n", regressions, missing);
+	if (regressions == 0 && missing > 0) return ScenarioBaselineMissing;
+	return regressions;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <PxPhysicsAPI.h>
+#include <cstdio>
+#include <vector>
+#include "objects.h"
+
+struct ScenarioParams {
+	unsigned int seed;
+	unsigned int size; // meaning depends on the scenario: tower height, pyramid base, domino count...
+	int steps;
+};
+
+// everything a scenario put into gScene, released between runs
+struct ScenarioWorld {
+	std::vector<Cube> bodies;
+	std::vector<physx::PxRigidActor*> statics;
+	unsigned int seed = 1;
+
+	float random(); // [0, 1), deterministic from the scenario seed
+	void release();
+};
+
+struct Scenario {
+	const char* name;
+	ScenarioParams params;
+	void (*build)(const ScenarioParams& params, ScenarioWorld& world);
+	void (*tick)(int step, ScenarioWorld& world); // bodies spawned mid-run, may be null
+};
+
+extern const Scenario scenarioLibrary[];
+extern const size_t scenarioCount;
+
+// returned when a scenario has no baseline, a run that checked nothing must not pass
+const int ScenarioBaselineMissing = -7;
+
+// runs every scenario on gScene and compares average and worst step time, render prep
+// time and memory growth with the baselines file. With updateBaselines every scenario is
+// recorded instead and 0 is returned. Otherwise returns the number of regressions, or
+// ScenarioBaselineMissing when there are none but some scenario had no baseline
+int runScenarioSuite(FILE* out, const char* baselinePath, bool updateBaselines);
@@ -1,23 +1,222 @@
 #include "shader.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+
+// extension entry points are loaded by hand so this works with a plain 3.3 core loader
+typedef void (APIENTRY* MaxShaderCompilerThreadsProc)(GLuint count);
+typedef void (APIENTRY* GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRY* ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRY* ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+static bool extensionsLoaded = false;
+static bool parallelCompile = false;
+static GetProgramBinaryProc pfnGetProgramBinary = nullptr;
+static ProgramBinaryProc pfnProgramBinary = nullptr;
+static ProgramParameteriProc pfnProgramParameteri = nullptr;
+static unsigned long long driverHash = 0;
+
+static const char* cacheDirectory = "shadercache";
+static const unsigned int cacheMagic = 0x31424853; // "SHB1"
+
+static unsigned long long fnv1a(const void* data, size_t size, unsigned long long hash = 0xcbf29ce484222325ULL) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static unsigned long long hashString(const char* text, unsigned long long hash) {
+	return text ? fnv1a(text, strlen(text), hash) : hash;
+}
+
+static void* getProc(const char* name) {
+	void* proc = (void*)wglGetProcAddress(name);
+	// some drivers return small sentinel values instead of null
+	if (proc == (void*)0 || proc == (void*)1 || proc == (void*)2 || proc == (void*)3 || proc == (void*)-1) return nullptr;
+	return proc;
+}
+
+static bool hasExtension(const char* name) {
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++) {
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (extension && strcmp(extension, name) == 0) return true;
+	}
+	return false;
+}
+
+static void loadExtensions() {
+	extensionsLoaded = true;
+
+	MaxShaderCompilerThreadsProc maxThreads = nullptr;
+	if (hasExtension("GL_KHR_parallel_shader_compile")) maxThreads = (MaxShaderCompilerThreadsProc)getProc("glMaxShaderCompilerThreadsKHR");
+	else if (hasExtension("GL_ARB_parallel_shader_compile")) maxThreads = (MaxShaderCompilerThreadsProc)getProc("glMaxShaderCompilerThreadsARB");
+	if (maxThreads) {
+		maxThreads(0xFFFFFFFF); // let the driver pick
+		parallelCompile = true;
+	}
+
+	if (hasExtension("GL_ARB_get_program_binary")) {
+		pfnGetProgramBinary = (GetProgramBinaryProc)getProc("glGetProgramBinary");
+		pfnProgramBinary = (ProgramBinaryProc)getProc("glProgramBinary");
+		pfnProgramParameteri = (ProgramParameteriProc)getProc("glProgramParameteri");
+		if (!pfnGetProgramBinary || !pfnProgramBinary || !pfnProgramParameteri) {
+			pfnGetProgramBinary = nullptr;
+			pfnProgramBinary = nullptr;
+			pfnProgramParameteri = nullptr;
+		}
+		else {
+			CreateDirectoryA(cacheDirectory, NULL);
+		}
+	}
+
+	// binaries are only valid for the driver that produced them
+	driverHash = hashString((const char*)glGetString(GL_VENDOR), 0xcbf29ce484222325ULL);
+	driverHash = hashString((const char*)glGetString(GL_RENDERER), driverHash);
+	driverHash = hashString((const char*)glGetString(GL_VERSION), driverHash);
+}
+
+static void cachePath(unsigned long long key, char* path, size_t size) {
+	snprintf(path, size, "%s/%016llx.bin", cacheDirectory, key);
+}
 
 Shader::Shader(const char* vertexSource, const char* fragmentSource) {
-	unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+	if (!extensionsLoaded) loadExtensions();
+
+	cacheKey = hashString(vertexSource, driverHash);
+	cacheKey = hashString(fragmentSource, cacheKey);
+
+	ID = glCreateProgram();
+	if (loadBinary()) return;
+
+	// no waiting here, with parallel compile the driver works on every program at once
+	vertexShader = glCreateShader(GL_VERTEX_SHADER);
+	fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
 	glShaderSource(vertexShader, 1, &vertexSource, NULL);
 	glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
 	glCompileShader(vertexShader);
 	glCompileShader(fragmentShader);
 
-	ID = glCreateProgram();
 	glAttachShader(ID, vertexShader);
 	glAttachShader(ID, fragmentShader);
+	if (pfnProgramParameteri) pfnProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(ID);
+}
+
+bool Shader::loadBinary() {
+	if (!pfnProgramBinary) return false;
+
+	char path[MAX_PATH];
+	cachePath(cacheKey, path, sizeof(path));
+	FILE* file = nullptr;
+	if (fopen_s(&file, path, "rb") != 0 || !file) return false;
+
+	unsigned int header[3] = {}; // magic, format, length
+	std::vector<char> binary;
+	bool ok = fread(header, sizeof(header), 1, file) == 1 && header[0] == cacheMagic && header[2] > 0;
+	if (ok) {
+		binary.resize(header[2]);
+		ok = fread(binary.data(), 1, binary.size(), file) == binary.size();
+	}
+	fclose(file);
+	if (!ok) return false;
+
+	pfnProgramBinary(ID, header[1], binary.data(), (GLsizei)binary.size());
+	GLint status = GL_FALSE;
+	glGetProgramiv(ID, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE) return false; // stale binary, compile from source instead
+
+	resolved = true;
+	linked = true;
+	fromCache = true;
+	return true;
+}
+
+void Shader::saveBinary() {
+	if (!pfnGetProgramBinary) return;
+
+	GLint length = 0;
+	glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) return;
+
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	pfnGetProgramBinary(ID, length, &length, &format, binary.data());
+
+	char path[MAX_PATH];
+	cachePath(cacheKey, path, sizeof(path));
+	FILE* file = nullptr;
+	if (fopen_s(&file, path, "wb") != 0 || !file) return;
+	unsigned int header[3] = { cacheMagic, format, (unsigned int)length };
+	fwrite(header, sizeof(header), 1, file);
+	fwrite(binary.data(), 1, length, file);
+	fclose(file);
+}
+
+void Shader::resolve() {
+	resolved = true;
+
+	GLint status = GL_FALSE;
+	glGetProgramiv(ID, GL_LINK_STATUS, &status);
+	linked = status == GL_TRUE;
+
+	if (!linked) {
+		char log[1024];
+		char message[4096];
+		int used = 0;
+		GLint compiled = GL_FALSE;
+		glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &compiled);
+		if (!compiled) {
+			glGetShaderInfoLog(vertexShader, sizeof(log), NULL, log);
+			used += snprintf(message + used, sizeof(message) - used, "Vertex shader:\n%s\n", log);
+		}
+		glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &compiled);
+		if (!compiled) {
+			glGetShaderInfoLog(fragmentShader, sizeof(log), NULL, log);
+			used += snprintf(message + used, sizeof(message) - used, "Fragment shader:\n%s\n", log);
+		}
+		glGetProgramInfoLog(ID, sizeof(log), NULL, log);
+		snprintf(message + used, sizeof(message) - used, "Program:\n%s\n", log);
+		MessageBoxA(NULL, message, "Shader error", MB_OK | MB_ICONWARNING);
+	}
+	else if (!fromCache) {
+		saveBinary();
+	}
 
 	glDeleteShader(vertexShader);
 	glDeleteShader(fragmentShader);
+	vertexShader = 0;
+	fragmentShader = 0;
+}
+
+bool Shader::ready() {
+	if (resolved) return true;
+	// without the extension the status query isn't there and asking means waiting
+	if (parallelCompile) {
+		GLint done = GL_FALSE;
+		glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+		if (!done) return false;
+	}
+	resolve();
+	return true;
 }
 
 void Shader::use() {
+	if (!resolved) resolve();
 	glUseProgram(ID);
 }
 
@@ -31,4 +230,8 @@ void Shader::setVec3(const char* name, const glm::vec3& value) {
 
 void Shader::setInt(const char* name, const int& value) {
 	glUniform1i(glGetUniformLocation(ID, name), value);
-}
\ No newline at end of file
+}
+
+void Shader::setVec4Array(const char* name, const glm::vec4* values, int count) {
+	glUniform4fv(glGetUniformLocation(ID, name), count, glm::value_ptr(values[0]));
+}
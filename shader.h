@@ -4,12 +4,29 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+// programs start compiling (or load from the binary cache) in the constructor
+// and are only waited on the first time they are used
 class Shader {
 public:
 	unsigned int ID;
 	Shader(const char* vertexSource, const char* fragmentSource);
 	void use();
+	// true once use() won't wait for the driver, never blocks when parallel compile is available
+	bool ready();
 	void setMat4(const char* name, const glm::mat4& value);
 	void setVec3(const char* name, const glm::vec3& value);
 	void setInt(const char* name, const int& value);
-};
\ No newline at end of file
+	void setVec4Array(const char* name, const glm::vec4* values, int count);
+
+private:
+	unsigned int vertexShader = 0;
+	unsigned int fragmentShader = 0;
+	unsigned long long cacheKey = 0;
+	bool resolved = false;
+	bool linked = false;
+	bool fromCache = false;
+
+	bool loadBinary();
+	void saveBinary();
+	void resolve();
+};
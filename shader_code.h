@@ -1,46 +1,103 @@
 #pragma once
 
-//CUBE
+// pasted into the lit fragment shaders after their uniforms, 3x3 PCF on the directional shadow map
+#define SHADOW_SAMPLING_GLSL R"(
+uniform sampler2D shadowMap;
+uniform mat4 lightSpace;
+
+float shadowFactor(vec3 worldPos, vec3 norm, vec3 lightDir) {
+	vec4 lightPos4 = lightSpace * vec4(worldPos, 1.0);
+	vec3 coord = lightPos4.xyz / lightPos4.w * 0.5 + 0.5;
+	if (coord.z > 1.0) return 0.0;
+
+	float bias = max(0.002 * (1.0 - dot(norm, lightDir)), 0.0005);
+	vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0));
+	float shadow = 0.0;
+	for (int x = -1; x <= 1; x++) {
+		for (int y = -1; y <= 1; y++) {
+			shadow += coord.z - bias > texture(shadowMap, coord.xy + vec2(x, y) * texel).r ? 1.0 : 0.0;
+		}
+	}
+	return shadow / 9.0;
+}
+)"
+
+// MATERIAL
+// cubes, spheres and agents: tint and texture layer come from the instance's material index
 
-const char* vertexShaderSource_cube = R"(
+const char* vertexShaderSource_material_instanced = R"(
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
-layout (location = 2) in vec3 aTexCoord;
+layout (location = 2) in vec2 aTexCoord;
 layout (location = 3) in mat4 aModel;
+layout (location = 7) in uint aMaterial;
 
 uniform mat4 view;
 uniform mat4 projection;
 
-out vec3 Normal;
 out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoord;
+flat out uint Material;
 
 void main() {
-	gl_Position = projection * view * aModel * vec4(aPos,1.0f);
-
-	FragPos = vec3(aModel * vec4(aPos, 1.0f));
+	vec4 worldPos = aModel * vec4(aPos, 1.0);
+	FragPos = vec3(worldPos);
 
 	mat3 normalMatrix = transpose(inverse(mat3(aModel)));
 	Normal = normalize(normalMatrix * aNormal);
+
+	TexCoord = aTexCoord;
+	Material = aMaterial;
+	gl_Position = projection * view * worldPos;
 }
 )";
 
-const char* fragmentShaderSource_cube = R"(
+// static batches, already in world space with the index baked into each vertex
+const char* vertexShaderSource_material_batch = R"(
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoord;
+layout (location = 7) in uint aMaterial;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoord;
+flat out uint Material;
+
+void main() {
+	FragPos = aPos;
+	Normal = aNormal;
+	TexCoord = aTexCoord;
+	Material = aMaterial;
+	gl_Position = projection * view * vec4(aPos, 1.0);
+}
+)";
+
+const char* fragmentShaderSource_material = R"(
 #version 330 core
 out vec4 FragColor;
 
-in vec3 Normal;
 in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoord;
+flat in uint Material;
 
-uniform vec3 objectColor;
 uniform vec3 lightColor;
 uniform vec3 lightPos;
 uniform vec3 viewPos;
-
+uniform vec4 materials[64]; // MaterialTable::MaxMaterials, tint in xyz, layer in w
+uniform sampler2DArray materialTextures;
+)" SHADOW_SAMPLING_GLSL R"(
 void main() {
 	vec3 norm = normalize(Normal);
 	vec3 lightDir = normalize(lightPos - FragPos);
-	
+
 	float diff = max(dot(norm,lightDir),0.0);
 	vec3 diffuse = diff * lightColor;
 
@@ -53,14 +110,17 @@ void main() {
 	float ambientStrength = 0.1f;
 	vec3 ambient = ambientStrength * lightColor;
 
-	vec3 result = (ambient+diffuse+specular)*objectColor;
+	vec4 material = materials[Material];
+	vec3 objectColor = material.xyz * texture(materialTextures, vec3(TexCoord, material.w)).rgb;
+
+	float shadow = shadowFactor(FragPos, norm, lightDir);
+	vec3 result = (ambient+(1.0-shadow)*(diffuse+specular))*objectColor;
 	FragColor = vec4(result,1.0f);
 }
 )";
 
-//SPHERE
-
-const char* vertexShaderSource_sphere = R"(
+// generic
+const char* vertexShaderSource_generic = R"(
 #version 330 core
 
 layout (location = 0) in vec3 aPos;
@@ -88,7 +148,7 @@ void main()
 }
 )";
 
-const char* fragmentShaderSource_sphere = R"(
+const char* fragmentShaderSource_generic = R"(
 #version 330 core
 
 in vec3 FragPos;
@@ -100,8 +160,8 @@ out vec4 FragColor;
 uniform vec3 lightPos;
 uniform vec3 lightColor;
 uniform vec3 viewPos;
-uniform sampler2D textureSampler;
-
+uniform vec3 objectColor;
+)" SHADOW_SAMPLING_GLSL R"(
 void main()
 {
     // diffuse lighting
@@ -122,80 +182,42 @@ void main()
     vec3 specular = specularStrength * spec * lightColor;
 
     // final color
-    vec3 objectColor = texture(textureSampler, TexCoord).rgb;
-    vec3 result = (ambient + diffuse + specular) * objectColor;
+    float shadow = shadowFactor(FragPos, norm, lightDir);
+    vec3 result = (ambient + (1.0 - shadow) * (diffuse + specular)) * objectColor;
     FragColor = vec4(result, 1.0);
 }
 
 )";
 
-// generic
-const char* vertexShaderSource_generic = R"(
+// shadow depth passes, instanced bodies and pre-transformed batches
+const char* vertexShaderSource_shadow_instanced = R"(
 #version 330 core
-
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
-layout (location = 2) in vec2 aTexCoord;
-
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (location = 3) in mat4 aModel;
 
-out vec3 FragPos;
-out vec3 Normal;
-out vec2 TexCoord;
+uniform mat4 lightSpace;
 
-void main()
-{
-    vec4 worldPos = model * vec4(aPos, 1.0);
-    FragPos = vec3(worldPos);
-    
-    mat3 normalMatrix = transpose(inverse(mat3(model)));
-    Normal = normalize(normalMatrix * aNormal);
-    
-    TexCoord = aTexCoord;
-    gl_Position = projection * view * worldPos;
+void main() {
+	gl_Position = lightSpace * aModel * vec4(aPos, 1.0);
 }
 )";
 
-const char* fragmentShaderSource_generic = R"(
+const char* vertexShaderSource_shadow = R"(
 #version 330 core
+layout (location = 0) in vec3 aPos;
 
-in vec3 FragPos;
-in vec3 Normal;
-in vec2 TexCoord;
-
-out vec4 FragColor;
-
-uniform vec3 lightPos;
-uniform vec3 lightColor;
-uniform vec3 viewPos;
-uniform vec3 objectColor;
-
-void main()
-{
-    // diffuse lighting
-    vec3 norm = normalize(Normal);
-    vec3 lightDir = normalize(lightPos - FragPos);
-    float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = diff * lightColor;
-
-    // ambient
-    float ambientStrength = 0.1;
-    vec3 ambient = ambientStrength * lightColor;
-
-    // specular
-    float specularStrength = 0.5;
-    vec3 viewDir = normalize(viewPos - FragPos);
-    vec3 reflectDir = reflect(-lightDir, norm);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32.0);
-    vec3 specular = specularStrength * spec * lightColor;
+uniform mat4 model;
+uniform mat4 lightSpace;
 
-    // final color
-    vec3 result = (ambient + diffuse + specular) * objectColor;
-    FragColor = vec4(result, 1.0);
+void main() {
+	gl_Position = lightSpace * model * vec4(aPos, 1.0);
 }
+)";
 
+const char* fragmentShaderSource_shadow = R"(
+#version 330 core
+void main() {
+}
 )";
 
 // skybox
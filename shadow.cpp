@@ -0,0 +1,166 @@
+#include "shadow.h"
+#include <glm/gtc/matrix_transform.hpp>
+
+unsigned int ShadowMap::createDepthTarget(unsigned int& fbo) {
+	unsigned int depth;
+	glGenTextures(1, &depth);
+	glBindTexture(GL_TEXTURE_2D, depth);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	float border[] = { 1.0f, 1.0f, 1.0f, 1.0f }; // outside the map is lit
+	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return depth;
+}
+
+void ShadowMap::init(const glm::vec3& lightDirection) {
+	direction = glm::normalize(lightDirection);
+	staticDepth = createDepthTarget(staticFBO);
+	frameDepth = createDepthTarget(frameFBO);
+	glGenQueries(PassCount * QueryFrames, &queries[0][0]);
+	staticDirty = true;
+	centered = false;
+}
+
+void ShadowMap::update(const glm::vec3& focus, unsigned int staticRevision) {
+	glm::vec3 ground(focus.x, 0.0f, focus.z);
+	if (!centered || glm::length(ground - center) > recenterDistance) {
+		center = ground;
+		centered = true;
+		staticDirty = true;
+
+		glm::vec3 up = glm::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		glm::mat4 lightView = glm::lookAt(center - direction * lightDistance, center, up);
+		glm::mat4 lightProjection = glm::ortho(-extent, extent, -extent, extent, 0.1f, lightDistance * 2.0f);
+		lightSpaceMatrix = lightProjection * lightView;
+	}
+	// a body that woke must lose its cached shadow and one that was baked must gain it
+	// in the same frame it changes lists, or it casts twice or not at all
+	if (staticRevision != revision) {
+		revision = staticRevision;
+		staticDirty = true;
+	}
+}
+
+void ShadowMap::collect(Pass pass, unsigned int slot, bool wait) {
+	if (!pending[pass][slot]) return;
+	if (!wait) {
+		GLint available = 0;
+		glGetQueryObjectiv(queries[pass][slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) return;
+	}
+
+	GLuint64 nanoseconds = 0;
+	glGetQueryObjectui64v(queries[pass][slot], GL_QUERY_RESULT, &nanoseconds);
+	pending[pass][slot] = false;
+
+	double ms = nanoseconds / 1.0e6;
+	if (pass == PassStatic) {
+		lastStaticMs = (float)ms;
+		return;
+	}
+	elapsedMs[pass] += ms;
+	elapsedCount[pass]++;
+}
+
+void ShadowMap::beginPass(Pass pass) {
+	unsigned int slot = queryFrame[pass]++ % QueryFrames;
+	collect(pass, slot, true);
+	glBeginQuery(GL_TIME_ELAPSED, queries[pass][slot]);
+	pending[pass][slot] = true;
+}
+
+void ShadowMap::endPass() {
+	glEndQuery(GL_TIME_ELAPSED);
+}
+
+void ShadowMap::drawCasters(Shader& depthShader, Shader& instancedDepthShader, const std::vector<ShadowCaster>& casters) {
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.0f, 4.0f);
+
+	Shader* bound = nullptr;
+	for (const ShadowCaster& caster : casters) {
+		Shader* shader = caster.instanceCount > 0 ? &instancedDepthShader : &depthShader;
+		if (shader != bound) {
+			shader->use();
+			shader->setMat4("lightSpace", lightSpaceMatrix);
+			if (shader == &depthShader) shader->setMat4("model", glm::mat4(1.0f));
+			bound = shader;
+		}
+
+		glBindVertexArray(caster.VAO);
+		if (caster.indexType == 0) {
+			if (caster.instanceCount > 0) glDrawArraysInstanced(GL_TRIANGLES, 0, caster.count, caster.instanceCount);
+			else glDrawArrays(GL_TRIANGLES, 0, caster.count);
+		}
+		else {
+			if (caster.instanceCount > 0) glDrawElementsInstanced(GL_TRIANGLES, caster.count, caster.indexType, 0, caster.instanceCount);
+			else glDrawElements(GL_TRIANGLES, caster.count, caster.indexType, 0);
+		}
+	}
+
+	glBindVertexArray(0);
+	glDisable(GL_POLYGON_OFFSET_FILL);
+}
+
+void ShadowMap::renderStatic(Shader& depthShader, Shader& instancedDepthShader, const std::vector<ShadowCaster>& casters) {
+	beginPass(PassStatic);
+	glBindFramebuffer(GL_FRAMEBUFFER, staticFBO);
+	glViewport(0, 0, size, size);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	drawCasters(depthShader, instancedDepthShader, casters);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	endPass();
+
+	staticDirty = false;
+	staticRedraws++;
+}
+
+void ShadowMap::renderDynamic(Shader& depthShader, Shader& instancedDepthShader, const std::vector<ShadowCaster>& casters, int viewportWidth, int viewportHeight) {
+	for (int pass = 0; pass < PassCount; pass++) {
+		for (unsigned int slot = 0; slot < QueryFrames; slot++) collect((Pass)pass, slot, false);
+	}
+
+	// the cached layer is copied, never redrawn
+	beginPass(PassBlit);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, staticFBO);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, frameFBO);
+	glBlitFramebuffer(0, 0, size, size, 0, 0, size, size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	endPass();
+
+	beginPass(PassDynamic);
+	glBindFramebuffer(GL_FRAMEBUFFER, frameFBO);
+	glViewport(0, 0, size, size);
+	drawCasters(depthShader, instancedDepthShader, casters);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	endPass();
+
+	glViewport(0, 0, viewportWidth, viewportHeight);
+}
+
+ShadowTimings ShadowMap::timings() const {
+	ShadowTimings t;
+	t.staticMs = lastStaticMs;
+	t.blitMs = elapsedCount[PassBlit] ? (float)(elapsedMs[PassBlit] / elapsedCount[PassBlit]) : 0.0f;
+	t.dynamicMs = elapsedCount[PassDynamic] ? (float)(elapsedMs[PassDynamic] / elapsedCount[PassDynamic]) : 0.0f;
+	t.staticRedraws = staticRedraws;
+	return t;
+}
+
+void ShadowMap::resetTimings() {
+	for (int pass = 0; pass < PassCount; pass++) {
+		elapsedMs[pass] = 0.0;
+		elapsedCount[pass] = 0;
+	}
+	staticRedraws = 0;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "shader.h"
+
+// one depth-only draw, the VAO has positions at location 0 and, when
+// instanceCount > 0, the instance matrices at 3-6
+struct ShadowCaster {
+	unsigned int VAO;
+	GLenum indexType; // 0 for glDrawArrays
+	GLsizei count;
+	GLsizei instanceCount; // 0 for pre-transformed geometry
+};
+
+// GPU time of each pass, averaged over the frames since the last reset
+struct ShadowTimings {
+	float staticMs;  // last cache redraw
+	float blitMs;
+	float dynamicMs;
+	unsigned int staticRedraws;
+};
+
+// directional shadow map with a cached layer: sleeping, batched geometry is drawn
+// into the static depth texture only when it changes or the frustum moves. Every
+// frame that layer is blitted into the sampled map and only the moving casters are
+// drawn on top, so the per frame cost follows what is awake
+class ShadowMap {
+public:
+	int size = 2048;
+	float extent = 40.0f;           // half width of the covered square, in meters
+	float recenterDistance = 10.0f; // focus movement before the frustum follows
+	float lightDistance = 60.0f;
+
+	void init(const glm::vec3& lightDirection);
+	// follows the focus in steps. Moving the frustum or a new batch revision invalidates
+	// the cache right away, the batcher is what keeps revisions infrequent
+	void update(const glm::vec3& focus, unsigned int staticRevision);
+	void invalidate() { staticDirty = true; }
+	bool needsStatic() const { return staticDirty; }
+
+	// redraws the cached layer, call before renderDynamic when needsStatic()
+	void renderStatic(Shader& depthShader, Shader& instancedDepthShader, const std::vector<ShadowCaster>& casters);
+	// leaves the default framebuffer and the given viewport bound
+	void renderDynamic(Shader& depthShader, Shader& instancedDepthShader, const std::vector<ShadowCaster>& casters, int viewportWidth, int viewportHeight);
+
+	unsigned int texture() const { return frameDepth; }
+	const glm::mat4& lightSpace() const { return lightSpaceMatrix; }
+	ShadowTimings timings() const;
+	void resetTimings();
+
+private:
+	enum Pass { PassStatic, PassBlit, PassDynamic, PassCount };
+	static const unsigned int QueryFrames = 4;
+
+	glm::vec3 direction = glm::vec3(0.0f, -1.0f, 0.0f);
+	glm::vec3 center = glm::vec3(0.0f);
+	glm::mat4 lightSpaceMatrix = glm::mat4(1.0f);
+	bool staticDirty = true;
+	bool centered = false;
+	unsigned int revision = 0;
+
+	unsigned int staticFBO = 0, staticDepth = 0;
+	unsigned int frameFBO = 0, frameDepth = 0;
+
+	unsigned int queries[PassCount][QueryFrames] = {};
+	bool pending[PassCount][QueryFrames] = {};
+	unsigned int queryFrame[PassCount] = {};
+	double elapsedMs[PassCount] = {};
+	unsigned int elapsedCount[PassCount] = {};
+	float lastStaticMs = 0.0f;
+	unsigned int staticRedraws = 0;
+
+	unsigned int createDepthTarget(unsigned int& fbo);
+	void beginPass(Pass pass);
+	void endPass();
+	void collect(Pass pass, unsigned int slot, bool wait);
+	void drawCasters(Shader& depthShader, Shader& instancedDepthShader, const std::vector<ShadowCaster>& casters);
+};
@@ -0,0 +1,209 @@
+#include "simlod.h"
+#include <cmath>
+
+using namespace physx;
+
+SimLod::Entry SimLod::makeEntry(PxRigidDynamic* body) {
+	Entry entry;
+	entry.body = body;
+	entry.tier = SimTier::Full;
+	entry.wasAwake = true;
+	entry.linearVelocity = PxVec3(0.0f);
+	entry.angularVelocity = PxVec3(0.0f);
+	entry.positionIters = 4;
+	entry.velocityIters = 1;
+	entry.sleepThreshold = 0.0f;
+	if (body) {
+		body->getSolverIterationCounts(entry.positionIters, entry.velocityIters);
+		entry.sleepThreshold = body->getSleepThreshold();
+	}
+	return entry;
+}
+
+void SimLod::add(PxRigidDynamic* body) {
+	entries.push_back(makeEntry(body));
+	wanted.push_back(SimTier::Full);
+	reserveMovers();
+}
+
+void SimLod::set(size_t index, PxRigidDynamic* body) {
+	if (index >= entries.size()) {
+		entries.resize(index + 1, makeEntry(nullptr));
+		wanted.resize(index + 1, SimTier::Full);
+		reserveMovers();
+	}
+	entries[index] = makeEntry(body);
+	wanted[index] = SimTier::Full;
+}
+
+SimTier SimLod::tier(size_t index) const {
+	return entries[index].tier;
+}
+
+unsigned int SimLod::count(SimTier tier) const {
+	unsigned int n = 0;
+	for (const Entry& entry : entries) {
+		if (entry.body && entry.tier == tier) n++;
+	}
+	return n;
+}
+
+SimTier SimLod::desiredTier(const Entry& entry, float distance) const {
+	// cheaper tiers only kick in once the body is past the radius plus the margin,
+	// so bodies sitting on a boundary don't flip every frame
+	float fullLimit = settings.fullRadius + (entry.tier != SimTier::Full ? 0.0f : settings.hysteresis);
+	float frozenLimit = settings.frozenRadius + (entry.tier == SimTier::Frozen ? 0.0f : settings.hysteresis);
+
+	if (distance < fullLimit) return SimTier::Full;
+	if (distance < frozenLimit) return SimTier::Reduced;
+
+	// never freeze something mid-flight, let it settle in the reduced tier first
+	if (entry.tier != SimTier::Frozen && !entry.body->isSleeping() &&
+		entry.body->getLinearVelocity().magnitude() > settings.freezeMaxSpeed) {
+		return SimTier::Reduced;
+	}
+	return SimTier::Frozen;
+}
+
+bool SimLod::isMover(const Entry& entry) const {
+	return entry.body && entry.tier != SimTier::Frozen && !entry.body->isSleeping() &&
+		entry.body->getLinearVelocity().magnitude() > settings.freezeMaxSpeed;
+}
+
+// every body could be a mover, sized up front so update never allocates
+void SimLod::reserveMovers() {
+	size_t buckets = 64;
+	while (buckets < entries.size() * 2) buckets <<= 1;
+	movers.reserve(entries.size());
+	moverCell.reserve(entries.size());
+	cellMovers.reserve(entries.size());
+	cellStart.reserve(buckets + 1);
+	cellCursor.reserve(buckets);
+}
+
+unsigned int SimLod::cellOf(int x, int z) const {
+	unsigned int h = ((unsigned int)x * 73856093u) ^ ((unsigned int)z * 19349663u);
+	return h & (unsigned int)(cellStart.size() - 2);
+}
+
+void SimLod::buildMoverGrid() {
+	size_t buckets = 64;
+	while (buckets < movers.size() * 2) buckets <<= 1;
+	cellStart.assign(buckets + 1, 0);
+	moverCell.resize(movers.size());
+	cellMovers.resize(movers.size());
+
+	for (size_t i = 0; i < movers.size(); i++) {
+		int x = (int)floorf(movers[i].x / settings.wakeRadius);
+		int z = (int)floorf(movers[i].z / settings.wakeRadius);
+		moverCell[i] = cellOf(x, z);
+		cellStart[moverCell[i] + 1]++;
+	}
+	for (size_t b = 0; b < buckets; b++) cellStart[b + 1] += cellStart[b];
+
+	cellCursor.assign(cellStart.begin(), cellStart.end() - 1);
+	for (size_t i = 0; i < movers.size(); i++) {
+		cellMovers[cellCursor[moverCell[i]]++] = (unsigned int)i;
+	}
+}
+
+bool SimLod::nearMover(const PxVec3& position) const {
+	if (movers.empty()) return false;
+	// cells are wakeRadius wide, so the 3x3 block around the body covers the radius
+	int cx = (int)floorf(position.x / settings.wakeRadius);
+	int cz = (int)floorf(position.z / settings.wakeRadius);
+	float limit = settings.wakeRadius * settings.wakeRadius;
+	for (int dz = -1; dz <= 1; dz++) {
+		for (int dx = -1; dx <= 1; dx++) {
+			unsigned int cell = cellOf(cx + dx, cz + dz);
+			for (unsigned int k = cellStart[cell]; k < cellStart[cell + 1]; k++) {
+				if ((position - movers[cellMovers[k]]).magnitudeSquared() < limit) return true;
+			}
+		}
+	}
+	return false;
+}
+
+void SimLod::apply(Entry& entry, SimTier target) {
+	PxRigidDynamic* body = entry.body;
+
+	if (entry.tier == SimTier::Frozen) {
+		body->setRigidBodyFlag(PxRigidBodyFlag::eKINEMATIC, false);
+		if (entry.wasAwake) {
+			body->setLinearVelocity(entry.linearVelocity);
+			body->setAngularVelocity(entry.angularVelocity);
+			body->wakeUp();
+		}
+	}
+
+	switch (target) {
+	case SimTier::Full:
+		body->setSolverIterationCounts(entry.positionIters, entry.velocityIters);
+		body->setSleepThreshold(entry.sleepThreshold);
+		break;
+	case SimTier::Reduced:
+		body->setSolverIterationCounts(settings.reducedPositionIters, settings.reducedVelocityIters);
+		body->setSleepThreshold(settings.reducedSleepThreshold);
+		break;
+	case SimTier::Frozen:
+		entry.wasAwake = !body->isSleeping();
+		entry.linearVelocity = body->getLinearVelocity();
+		entry.angularVelocity = body->getAngularVelocity();
+		body->setRigidBodyFlag(PxRigidBodyFlag::eKINEMATIC, true);
+		break;
+	}
+
+	entry.tier = target;
+}
+
+bool SimLod::thaw(PxRigidDynamic* body) {
+	for (Entry& entry : entries) {
+		if (entry.body != body) continue;
+		if (entry.tier == SimTier::Frozen) apply(entry, SimTier::Reduced);
+		return true;
+	}
+	return false;
+}
+
+void SimLod::update(const PxVec3* focusPoints, unsigned int focusCount) {
+	if (focusCount == 0) return;
+
+	// anything flying around far from the focus points would hit frozen bodies like
+	// walls, so fast bodies thaw whatever they get close to as well
+	movers.clear();
+	for (const Entry& entry : entries) {
+		if (isMover(entry)) movers.push_back(entry.body->getGlobalPose().p);
+	}
+	buildMoverGrid();
+
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (!entries[i].body) {
+			wanted[i] = entries[i].tier;
+			continue;
+		}
+		PxVec3 p = entries[i].body->getGlobalPose().p;
+		float best = PX_MAX_F32;
+		for (unsigned int f = 0; f < focusCount; f++) {
+			float d = (p - focusPoints[f]).magnitudeSquared();
+			if (d < best) best = d;
+		}
+		wanted[i] = desiredTier(entries[i], PxSqrt(best));
+		if (wanted[i] == SimTier::Frozen && nearMover(p)) wanted[i] = SimTier::Reduced;
+	}
+
+	// promotions first so anything approaching the player comes back to full rate
+	// before the budget is spent on far away demotions
+	unsigned int budget = settings.maxTransitionsPerFrame;
+	for (size_t i = 0; i < entries.size() && budget > 0; i++) {
+		if (wanted[i] < entries[i].tier) {
+			apply(entries[i], wanted[i]);
+			budget--;
+		}
+	}
+	for (size_t i = 0; i < entries.size() && budget > 0; i++) {
+		if (wanted[i] > entries[i].tier) {
+			apply(entries[i], wanted[i]);
+			budget--;
+		}
+	}
+}
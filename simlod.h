@@ -0,0 +1,69 @@
+#pragma once
+#include <PxPhysicsAPI.h>
+#include <vector>
+
+// simulation level of detail around a set of focus points (player, projectiles)
+enum class SimTier : unsigned char {
+	Full,    // default solver settings
+	Reduced, // fewer solver iterations, sleeps early
+	Frozen   // kinematic, velocities stashed until thawed
+};
+
+struct SimLodSettings {
+	float fullRadius = 25.0f;    // closer than this: Full
+	float frozenRadius = 50.0f;  // further than this: Frozen
+	float hysteresis = 2.0f;     // margin before a body falls back to a cheaper tier
+	float freezeMaxSpeed = 0.5f; // bodies moving faster than this are never frozen
+	float wakeRadius = 3.0f;     // frozen bodies this close to one of those thaw into Reduced
+	physx::PxU32 reducedPositionIters = 1;
+	physx::PxU32 reducedVelocityIters = 1;
+	physx::PxReal reducedSleepThreshold = 0.5f;
+	unsigned int maxTransitionsPerFrame = 64;
+};
+
+class SimLod {
+public:
+	SimLodSettings settings;
+
+	// bodies are identified by the order they were added in
+	void add(physx::PxRigidDynamic* body);
+	// rebinds a slot for streamed bodies, nullptr leaves it empty
+	void set(size_t index, physx::PxRigidDynamic* body);
+	void update(const physx::PxVec3* focusPoints, unsigned int focusCount);
+	// brings a frozen body back to the reduced tier right away, e.g. before pushing it.
+	// Returns false when the body isn't managed here
+	bool thaw(physx::PxRigidDynamic* body);
+	SimTier tier(size_t index) const;
+	unsigned int count(SimTier tier) const;
+
+private:
+	struct Entry {
+		physx::PxRigidDynamic* body;
+		SimTier tier;
+		bool wasAwake;
+		physx::PxVec3 linearVelocity;
+		physx::PxVec3 angularVelocity;
+		physx::PxU32 positionIters;
+		physx::PxU32 velocityIters;
+		physx::PxReal sleepThreshold;
+	};
+
+	std::vector<Entry> entries;
+	std::vector<SimTier> wanted;
+	// fast bodies outside the frozen tier in a spatial hash with wakeRadius cells, so a
+	// frozen body only looks at the movers in the cells around it. Refilled every update
+	std::vector<physx::PxVec3> movers;
+	std::vector<unsigned int> moverCell;
+	std::vector<unsigned int> cellStart;
+	std::vector<unsigned int> cellCursor;
+	std::vector<unsigned int> cellMovers;
+
+	static Entry makeEntry(physx::PxRigidDynamic* body);
+	SimTier desiredTier(const Entry& entry, float distance) const;
+	bool isMover(const Entry& entry) const;
+	void reserveMovers();
+	unsigned int cellOf(int x, int z) const;
+	void buildMoverGrid();
+	bool nearMover(const physx::PxVec3& position) const;
+	void apply(Entry& entry, SimTier target);
+};
@@ -0,0 +1,278 @@
+#include "staticbatch.h"
+#include "allocaudit.h"
+#include <chrono>
+#include <algorithm>
+#include <cstddef>
+
+void StaticBatcher::init(const float* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount) {
+	meshVertices = vertices;
+	meshVertexCount = vertexCount;
+	meshIndices = indices;
+	meshIndexCount = indexCount;
+	scratch.resize(meshVertexCount);
+}
+
+bool StaticBatcher::isBatched(size_t index) const {
+	return index < bodies.size() && bodies[index].batch >= 0;
+}
+
+unsigned int StaticBatcher::batchedCount() const {
+	unsigned int n = 0;
+	for (auto& batch : batches) n += batch->live;
+	return n;
+}
+
+unsigned int StaticBatcher::batchCount() const {
+	return (unsigned int)batches.size();
+}
+
+void StaticBatcher::bakeVertices(const glm::mat4& model, unsigned int material, BakedVertex* out) const {
+	glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+	for (unsigned int v = 0; v < meshVertexCount; v++) {
+		const float* in = meshVertices + v * 8;
+		glm::vec3 pos = glm::vec3(model * glm::vec4(in[0], in[1], in[2], 1.0f));
+		glm::vec3 normal = glm::normalize(normalMatrix * glm::vec3(in[3], in[4], in[5]));
+		BakedVertex& o = out[v];
+		o.vertex.position[0] = pos.x;
+		o.vertex.position[1] = pos.y;
+		o.vertex.position[2] = pos.z;
+		o.vertex.normal = packNormal(normal);
+		o.vertex.texCoord[0] = floatToHalf(in[6]);
+		o.vertex.texCoord[1] = floatToHalf(in[7]);
+		o.material = material;
+	}
+}
+
+void StaticBatcher::writeSlot(Batch& batch, unsigned int slot, const BakedVertex* data) {
+	GLsizeiptr slotSize = meshVertexCount * sizeof(BakedVertex);
+	glBindBuffer(GL_ARRAY_BUFFER, batch.buffer.VBO);
+	glBufferSubData(GL_ARRAY_BUFFER, slot * slotSize, slotSize, data);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+int StaticBatcher::createBatch() {
+	// every vertex of a batch has to be addressable with an unsigned short
+	batchCapacity = std::min(batchCapacity, 65536u / meshVertexCount);
+
+	std::unique_ptr<Batch> batch(new Batch());
+	batch->slots.reserve(batchCapacity);
+	batch->models.reserve(batchCapacity);
+	batch->materials.reserve(batchCapacity);
+
+	std::vector<unsigned short> indices(batchCapacity * meshIndexCount);
+	for (unsigned int slot = 0; slot < batchCapacity; slot++) {
+		for (unsigned int i = 0; i < meshIndexCount; i++) {
+			indices[slot * meshIndexCount + i] = (unsigned short)(meshIndices[i] + slot * meshVertexCount);
+		}
+	}
+
+	ObjectBuffer& buffer = batch->buffer;
+	glGenVertexArrays(1, &buffer.VAO);
+	glGenBuffers(1, &buffer.VBO);
+	glGenBuffers(1, &buffer.EBO);
+
+	glBindVertexArray(buffer.VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer.VBO);
+	glBufferData(GL_ARRAY_BUFFER, batchCapacity * meshVertexCount * sizeof(BakedVertex), nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), indices.data(), GL_STATIC_DRAW);
+
+	GLsizei stride = sizeof(BakedVertex);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);                                         // position
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offsetof(PackedVertex, normal)); // normal
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(PackedVertex, texCoord));     // texcoord
+	glEnableVertexAttribArray(2);
+	glVertexAttribIPointer(7, 1, GL_UNSIGNED_INT, stride, (void*)offsetof(BakedVertex, material));            // material
+	glEnableVertexAttribArray(7);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	batches.push_back(std::move(batch));
+	return (int)batches.size() - 1;
+}
+
+void StaticBatcher::evict(size_t index) {
+	AuditPhaseScope spawn(FramePhase::Spawn);
+	BodyState& state = bodies[index];
+	Batch& batch = *batches[state.batch];
+
+	// collapse the slot to degenerate triangles, the draw call itself stays the same
+	std::fill(scratch.begin(), scratch.end(), BakedVertex{});
+	writeSlot(batch, state.slot, scratch.data());
+
+	batch.slots[state.slot] = EmptySlot;
+	batch.positionSum -= glm::vec3(batch.models[state.slot][3]);
+	batch.live--;
+	state.batch = -1;
+	changes++;
+}
+
+void StaticBatcher::insert(const std::vector<Cube>& cubes, size_t index) {
+	AuditPhaseScope spawn(FramePhase::Spawn);
+	const Cube& cube = cubes[index];
+
+	int target = -1;
+	for (size_t b = 0; b < batches.size() && target < 0; b++) {
+		Batch& batch = *batches[b];
+		if (batch.rebuilding) continue;
+		if (batch.live < batchCapacity) target = (int)b;
+	}
+	if (target < 0) target = createBatch();
+
+	Batch& batch = *batches[target];
+	unsigned int slot = 0;
+	while (slot < batch.slots.size() && batch.slots[slot] != EmptySlot) slot++;
+	if (slot == batch.slots.size()) {
+		batch.slots.push_back(EmptySlot);
+		batch.models.push_back(glm::mat4(1.0f));
+		batch.materials.push_back(0);
+	}
+
+	glm::mat4 model = GetCubeModel(cube);
+	bakeVertices(model, cube.Material, scratch.data());
+	writeSlot(batch, slot, scratch.data());
+
+	batch.slots[slot] = index;
+	batch.models[slot] = model;
+	batch.materials[slot] = cube.Material;
+	batch.positionSum += glm::vec3(model[3]);
+	batch.live++;
+	bodies[index].batch = target;
+	bodies[index].slot = slot;
+	changes++;
+}
+
+void StaticBatcher::remove(size_t index) {
+	if (index >= bodies.size()) return;
+	if (bodies[index].batch >= 0) evict(index);
+	bodies[index].framesAsleep = 0;
+}
+
+void StaticBatcher::startRebuild(Batch& batch) {
+	AuditPhaseScope spawn(FramePhase::Spawn);
+	std::vector<size_t> members;
+	std::vector<glm::mat4> models;
+	std::vector<unsigned int> materials;
+	members.reserve(batch.live);
+	models.reserve(batch.live);
+	materials.reserve(batch.live);
+	for (size_t slot = 0; slot < batch.slots.size(); slot++) {
+		if (batch.slots[slot] == EmptySlot) continue;
+		members.push_back(batch.slots[slot]);
+		models.push_back(batch.models[slot]);
+		materials.push_back(batch.materials[slot]);
+	}
+
+	// baking is pure CPU work on snapshots, only the upload has to happen on the GL thread
+	batch.rebuilding = true;
+	batch.rebuild = std::async(std::launch::async, [this, members, models, materials]() {
+		// baking is restructuring, whenever it happens to run
+		auditSpawnThread();
+		RebuildJob job;
+		job.members = members;
+		job.vertices.resize(members.size() * meshVertexCount);
+		for (size_t i = 0; i < members.size(); i++) {
+			bakeVertices(models[i], materials[i], job.vertices.data() + i * meshVertexCount);
+		}
+		return job;
+	});
+}
+
+void StaticBatcher::finishRebuild(int batchIndex) {
+	AuditPhaseScope spawn(FramePhase::Spawn);
+	Batch& batch = *batches[batchIndex];
+	RebuildJob job = batch.rebuild.get();
+	batch.rebuilding = false;
+
+	std::vector<glm::mat4> models(job.members.size());
+	std::vector<unsigned int> materials(job.members.size(), 0);
+	for (size_t slot = 0; slot < job.members.size(); slot++) {
+		size_t index = job.members[slot];
+		BodyState& state = bodies[index];
+		if (state.batch != batchIndex) {
+			// woke up while the job was running
+			std::fill_n(job.vertices.begin() + slot * meshVertexCount, meshVertexCount, BakedVertex{});
+			job.members[slot] = EmptySlot;
+			continue;
+		}
+		models[slot] = batch.models[state.slot];
+		materials[slot] = batch.materials[state.slot];
+		state.slot = (unsigned int)slot;
+	}
+
+	if (!job.vertices.empty()) {
+		glBindBuffer(GL_ARRAY_BUFFER, batch.buffer.VBO);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, job.vertices.size() * sizeof(BakedVertex), job.vertices.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	batch.slots = job.members;
+	batch.models = models;
+	batch.materials = materials;
+}
+
+void StaticBatcher::update(const std::vector<Cube>& cubes) {
+	// the scans below run every frame in the caller's phase, only evict, insert and the
+	// rebuilds restructure batches and are charged to spawn
+	if (bodies.size() < cubes.size()) {
+		AuditPhaseScope spawn(FramePhase::Spawn);
+		bodies.resize(cubes.size());
+	}
+
+	for (size_t b = 0; b < batches.size(); b++) {
+		Batch& batch = *batches[b];
+		if (batch.rebuilding && batch.rebuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+			finishRebuild((int)b);
+		}
+	}
+
+	// every change redraws the cached shadow layer, so bodies that settle on different
+	// frames wait for the next insert frame and go in together. They stay dynamic (and
+	// cast dynamic shadows) until then, evictions can't wait and happen at once
+	bool insertFrame = ++frame % insertInterval == 0;
+	for (size_t i = 0; i < cubes.size(); i++) {
+		BodyState& state = bodies[i];
+		if (!cubes[i].pxRigidBody) continue;
+		if (!cubes[i].pxRigidBody->isSleeping()) {
+			if (state.batch >= 0) evict(i);
+			state.framesAsleep = 0;
+			continue;
+		}
+		if (state.batch >= 0) continue;
+		if (++state.framesAsleep >= settleFrames && insertFrame) insert(cubes, i);
+	}
+
+	for (auto& batch : batches) {
+		if (batch->rebuilding) continue;
+		if (batch->live == 0) {
+			batch->slots.clear();
+			batch->models.clear();
+			batch->materials.clear();
+			batch->positionSum = glm::vec3(0.0f);
+			continue;
+		}
+		size_t holes = batch->slots.size() - batch->live;
+		if (holes > 0 && holes >= rebuildFragmentation * batch->slots.size()) startRebuild(*batch);
+	}
+}
+
+void StaticBatcher::submit(RenderQueue& queue, Shader& shader, const glm::vec3& eye) {
+	for (auto& batch : batches) {
+		if (batch->slots.empty() || batch->live == 0) continue;
+		glm::vec3 center = batch->positionSum / (float)batch->live;
+
+		DrawPacket packet = RenderQueue::packet(shader, batch->buffer.VAO, GL_UNSIGNED_SHORT, (GLsizei)(batch->slots.size() * meshIndexCount));
+		packet.key = RenderQueue::makeKey(RenderLayer::Opaque, glm::length(center - eye), shader.ID, batch->buffer.VAO, 0);
+		queue.submit(packet);
+	}
+}
+
+void StaticBatcher::collectCasters(std::vector<ShadowCaster>& out) const {
+	for (auto& batch : batches) {
+		if (batch->slots.empty() || batch->live == 0) continue;
+		out.push_back(ShadowCaster{ batch->buffer.VAO, GL_UNSIGNED_SHORT, (GLsizei)(batch->slots.size() * meshIndexCount), 0 });
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <glad/glad.h>
+#include <vector>
+#include <future>
+#include <memory>
+#include "objects.h"
+#include "mesh.h"
+#include "shader.h"
+#include "renderqueue.h"
+#include "shadow.h"
+
+// bakes bodies that have been asleep for a while into merged, pre-transformed
+// vertex buffers so they drop out of the per-frame instance upload. Each baked
+// vertex carries its body's material index, so one batch holds any mix of looks
+class StaticBatcher {
+public:
+	unsigned int settleFrames = 120;   // frames asleep before a body gets baked
+	unsigned int insertInterval = 15;  // settled bodies are baked together every this many frames
+	unsigned int batchCapacity = 128;  // bodies per batch, capped so a batch stays within 16 bit indices
+	float rebuildFragmentation = 0.5f; // fraction of dead slots that triggers a compaction
+
+	// mesh in the 8 float position/normal/uv layout used by cube.h
+	void init(const float* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount);
+	// cubes with a null body are empty slots and are skipped
+	void update(const std::vector<Cube>& cubes);
+	// call before the body of a slot is released or the slot is reused
+	void remove(size_t index);
+	void submit(RenderQueue& queue, Shader& shader, const glm::vec3& eye);
+	bool isBatched(size_t index) const;
+	unsigned int batchedCount() const;
+	unsigned int batchCount() const;
+	// bumped whenever baked geometry changes, cached shadows compare against it
+	unsigned int revision() const { return changes; }
+	void collectCasters(std::vector<ShadowCaster>& out) const;
+
+private:
+	static const size_t EmptySlot = (size_t)-1;
+
+	// the packed uploadMesh layout plus the body's material index at location 7
+	struct BakedVertex {
+		PackedVertex vertex;
+		unsigned int material;
+	};
+
+	struct BodyState {
+		unsigned int framesAsleep = 0;
+		int batch = -1;
+		unsigned int slot = 0;
+	};
+
+	struct RebuildJob {
+		std::vector<size_t> members;
+		std::vector<BakedVertex> vertices;
+	};
+
+	struct Batch {
+		ObjectBuffer buffer;
+		std::vector<size_t> slots; // body index per slot, EmptySlot for holes
+		std::vector<glm::mat4> models; // transform each slot was baked with
+		std::vector<unsigned int> materials;
+		unsigned int live = 0;
+		glm::vec3 positionSum = glm::vec3(0.0f); // of live slots, for sorting
+		bool rebuilding = false;
+		std::future<RebuildJob> rebuild;
+	};
+
+	const float* meshVertices = nullptr;
+	const unsigned int* meshIndices = nullptr;
+	unsigned int meshVertexCount = 0;
+	unsigned int meshIndexCount = 0;
+
+	std::vector<BodyState> bodies;
+	std::vector<std::unique_ptr<Batch>> batches;
+	std::vector<BakedVertex> scratch;
+	unsigned int changes = 0;
+	unsigned int frame = 0;
+
+	void bakeVertices(const glm::mat4& model, unsigned int material, BakedVertex* out) const;
+	void writeSlot(Batch& batch, unsigned int slot, const BakedVertex* data);
+	void evict(size_t index);
+	void insert(const std::vector<Cube>& cubes, size_t index);
+	int createBatch();
+	void startRebuild(Batch& batch);
+	void finishRebuild(int batchIndex);
+};
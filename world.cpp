@@ -0,0 +1,397 @@
+#include <windows.h>
+#include "world.h"
+#include "physics.h"
+#include "material.h"
+#include "allocaudit.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+
+using namespace physx;
+
+static const unsigned int WorldMagic = 0x44575850; // "PXWD"
+static const unsigned int WorldVersion = 1;
+
+bool generateWorld(const char* path, const WorldGenSettings& settings) {
+	unsigned int chunkCount = settings.chunksX * settings.chunksZ;
+	float originX = -0.5f * settings.chunksX * settings.chunkSize;
+	float originZ = -0.5f * settings.chunksZ * settings.chunkSize;
+
+	std::vector<WorldChunkEntry> table(chunkCount);
+	std::vector<ChunkBody> bodies;
+	unsigned int seed = settings.seed;
+	auto next = [&seed]() {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) / (float)(1 << 24);
+	};
+
+	unsigned long long offset = sizeof(WorldFileHeader) + chunkCount * sizeof(WorldChunkEntry);
+	for (unsigned int z = 0; z < settings.chunksZ; z++) {
+		for (unsigned int x = 0; x < settings.chunksX; x++) {
+			WorldChunkEntry& entry = table[z * settings.chunksX + x];
+			entry.offset = offset + bodies.size() * sizeof(ChunkBody);
+			entry.reserved = 0;
+			size_t first = bodies.size();
+
+			// 3x3 towers kept off the chunk border so neighbours never overlap
+			for (unsigned int t = 0; t < settings.towersPerChunk; t++) {
+				float baseX = originX + x * settings.chunkSize + 2.0f + next() * (settings.chunkSize - 6.0f);
+				float baseZ = originZ + z * settings.chunkSize + 2.0f + next() * (settings.chunkSize - 6.0f);
+				unsigned int height = settings.minTowerHeight + (unsigned int)(next() * (settings.maxTowerHeight - settings.minTowerHeight + 1));
+				for (unsigned int k = 0; k < height; k++) {
+					for (unsigned int i = 0; i < 3; i++) {
+						for (unsigned int j = 0; j < 3; j++) {
+							ChunkBody body = {
+								{ baseX + i * 1.0f, 0.1f + k * 1.05f, baseZ + j * 1.0f },
+								{ 0.5f, 0.5f, 0.5f },
+								{ 0.49f, 0.27f, 0.47f },
+								BodyKindCube
+							};
+							bodies.push_back(body);
+						}
+					}
+				}
+			}
+			entry.bodyCount = (unsigned int)(bodies.size() - first);
+		}
+	}
+
+	WorldFileHeader header = { WorldMagic, WorldVersion, settings.chunksX, settings.chunksZ, settings.chunkSize,
+		originX, originZ, (unsigned int)bodies.size() };
+
+	FILE* file = nullptr;
+	if (fopen_s(&file, path, "wb") != 0 || !file) return false;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(table.data(), sizeof(WorldChunkEntry), table.size(), file) == table.size() &&
+		fwrite(bodies.data(), sizeof(ChunkBody), bodies.size(), file) == bodies.size();
+	fclose(file);
+	return ok;
+}
+
+WorldFile::~WorldFile() {
+	close();
+}
+
+bool WorldFile::open(const char* path) {
+	close();
+
+	HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) return false;
+	file = handle;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(WorldFileHeader)) {
+		close();
+		return false;
+	}
+	size = (unsigned long long)fileSize.QuadPart;
+
+	mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		close();
+		return false;
+	}
+	view = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view) {
+		close();
+		return false;
+	}
+
+	// validate the table up front so chunk reads never need to
+	const WorldFileHeader& h = header();
+	unsigned long long chunkCount = (unsigned long long)h.chunksX * h.chunksZ;
+	if (h.magic != WorldMagic || h.version != WorldVersion || h.chunkSize <= 0.0f ||
+		sizeof(WorldFileHeader) + chunkCount * sizeof(WorldChunkEntry) > size) {
+		close();
+		return false;
+	}
+	for (unsigned int i = 0; i < chunkCount; i++) {
+		const WorldChunkEntry& entry = chunk(i);
+		if (entry.offset > size || entry.bodyCount > (size - entry.offset) / sizeof(ChunkBody)) {
+			close();
+			return false;
+		}
+	}
+	return true;
+}
+
+void WorldFile::close() {
+	if (view) UnmapViewOfFile(view);
+	if (mapping) CloseHandle(mapping);
+	if (file) CloseHandle(file);
+	view = nullptr;
+	mapping = nullptr;
+	file = nullptr;
+	size = 0;
+}
+
+const WorldChunkEntry& WorldFile::chunk(unsigned int index) const {
+	return ((const WorldChunkEntry*)(view + sizeof(WorldFileHeader)))[index];
+}
+
+const ChunkBody* WorldFile::bodies(unsigned int index) const {
+	return (const ChunkBody*)(view + chunk(index).offset);
+}
+
+WorldStreamer::~WorldStreamer() {
+	close();
+}
+
+bool WorldStreamer::open(const char* path) {
+	close();
+	if (!world.open(path)) return false;
+
+	const WorldFileHeader& h = world.header();
+	chunks.clear();
+	chunks.resize(h.chunksX * h.chunksZ);
+	focusX = focusZ = 0x7FFFFFFF;
+	stopping = false;
+	loader = std::thread(&WorldStreamer::loaderMain, this);
+	return true;
+}
+
+void WorldStreamer::close() {
+	if (loader.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_one();
+		loader.join();
+	}
+
+	// whatever never made it into the scene
+	for (LoadResult& result : results) {
+		for (StreamedBody& body : result.bodies) body.actor->release();
+	}
+	for (Chunk& chunk : chunks) {
+		for (StreamedBody& body : chunk.pending) body.actor->release();
+	}
+	results.clear();
+	requests.clear();
+	chunks.clear();
+	active.clear();
+	loadsInFlight = 0;
+	world.close();
+}
+
+void WorldStreamer::loaderMain() {
+	auditSpawnThread();
+	for (;;) {
+		unsigned int index;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this]() { return stopping || !requests.empty(); });
+			if (stopping) return;
+			index = requests.front();
+			requests.pop_front();
+		}
+
+		// the first touch of the mapped records is where the chunk gets paged in
+		LoadResult result;
+		result.chunk = index;
+		unsigned int count = world.chunk(index).bodyCount;
+		const ChunkBody* records = world.bodies(index);
+		result.bodies.reserve(count);
+		for (unsigned int i = 0; i < count; i++) {
+			const ChunkBody& record = records[i];
+			PxVec3 halfExtents(record.halfExtents[0], record.halfExtents[1], record.halfExtents[2]);
+			StreamedBody body;
+			body.actor = createPxCube(PxVec3(record.position[0], record.position[1], record.position[2]), halfExtents, false);
+			body.scale = glm::vec3(halfExtents.x, halfExtents.y, halfExtents.z) * 2.0f;
+			body.color = glm::vec3(record.color[0], record.color[1], record.color[2]);
+			result.bodies.push_back(body);
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		results.push_back(std::move(result));
+	}
+}
+
+void WorldStreamer::request(unsigned int chunk) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		requests.push_back(chunk);
+	}
+	wake.notify_one();
+	loadsInFlight++;
+}
+
+unsigned int WorldStreamer::residentChunks() const {
+	unsigned int n = 0;
+	for (unsigned int index : active) {
+		if (chunks[index].state == ChunkState::Loaded) n++;
+	}
+	return n;
+}
+
+void WorldStreamer::refreshWanted(int cx, int cz) {
+	const WorldFileHeader& h = world.header();
+
+	for (unsigned int index : active) {
+		int x = (int)(index % h.chunksX);
+		int z = (int)(index / h.chunksX);
+		if (PxMax(abs(x - cx), abs(z - cz)) <= settings.unloadRadius) continue;
+
+		Chunk& chunk = chunks[index];
+		chunk.wanted = false;
+		if (chunk.state == ChunkState::Inserting || chunk.state == ChunkState::Loaded) {
+			chunk.state = ChunkState::Removing;
+		}
+		else if (chunk.state == ChunkState::Loading) {
+			// still queued: drop the request, otherwise the result gets released on arrival
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto it = requests.begin(); it != requests.end(); ++it) {
+				if (*it != index) continue;
+				requests.erase(it);
+				chunk.state = ChunkState::Unloaded;
+				loadsInFlight--;
+				break;
+			}
+		}
+	}
+
+	// nearest rings first so the chunk under the player is always queued before the rest
+	for (int ring = 0; ring <= settings.loadRadius; ring++) {
+		for (int dz = -ring; dz <= ring; dz++) {
+			for (int dx = -ring; dx <= ring; dx++) {
+				if (PxMax(abs(dx), abs(dz)) != ring) continue;
+				int x = cx + dx, z = cz + dz;
+				if (x < 0 || z < 0 || x >= (int)h.chunksX || z >= (int)h.chunksZ) continue;
+
+				unsigned int index = (unsigned int)(z * h.chunksX + x);
+				Chunk& chunk = chunks[index];
+				chunk.wanted = true;
+				if (chunk.state == ChunkState::Unloaded) {
+					chunk.state = ChunkState::Loading;
+					active.push_back(index);
+					request(index);
+				}
+			}
+		}
+	}
+}
+
+void WorldStreamer::removeBodies(Chunk& chunk, std::vector<Cube>& cubes, unsigned int& budget) {
+	while (budget > 0 && !chunk.pending.empty()) {
+		chunk.pending.back().actor->release();
+		chunk.pending.pop_back();
+		budget--;
+	}
+
+	batch.clear();
+	while (budget > 0 && !chunk.slots.empty()) {
+		size_t slot = chunk.slots.back();
+		chunk.slots.pop_back();
+		batch.push_back(cubes[slot].pxRigidBody);
+		cubes[slot].pxRigidBody = nullptr;
+		freeSlots.push_back(slot);
+		removed.push_back(slot);
+		budget--;
+	}
+	if (batch.empty()) return;
+
+	gScene->removeActors(batch.data(), (PxU32)batch.size());
+	for (PxActor* actor : batch) actor->release();
+}
+
+void WorldStreamer::insertBodies(Chunk& chunk, std::vector<Cube>& cubes, MaterialTable& materials, unsigned int& budget) {
+	batch.clear();
+	while (budget > 0 && !chunk.pending.empty()) {
+		const StreamedBody& body = chunk.pending.back();
+		size_t slot;
+		if (!freeSlots.empty()) {
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else {
+			slot = cubes.size();
+			cubes.push_back(Cube());
+		}
+
+		cubes[slot].Scale = body.scale;
+		cubes[slot].Material = materials.find(body.color, MaterialTable::WhiteLayer);
+		cubes[slot].pxRigidBody = body.actor;
+		chunk.slots.push_back(slot);
+		inserted.push_back(slot);
+		batch.push_back(body.actor);
+		chunk.pending.pop_back();
+		budget--;
+	}
+	if (!batch.empty()) gScene->addActors(batch.data(), (PxU32)batch.size());
+}
+
+void WorldStreamer::update(const PxVec3& focus, std::vector<Cube>& cubes, MaterialTable& materials) {
+	removed.clear();
+	inserted.clear();
+	if (!world.isOpen()) return;
+
+	const WorldFileHeader& h = world.header();
+	int cx = (int)floorf((focus.x - h.originX) / h.chunkSize);
+	int cz = (int)floorf((focus.z - h.originZ) / h.chunkSize);
+	// the per frame scans run in the caller's phase, only work on a chunk that is
+	// loading or leaving is charged to spawn
+	if (cx != focusX || cz != focusZ) {
+		AuditPhaseScope spawn(FramePhase::Spawn);
+		focusX = cx;
+		focusZ = cz;
+		refreshWanted(cx, cz);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		drained.swap(results);
+	}
+	for (LoadResult& result : drained) {
+		AuditPhaseScope spawn(FramePhase::Spawn);
+		loadsInFlight--;
+		Chunk& chunk = chunks[result.chunk];
+		if (!chunk.wanted) {
+			for (StreamedBody& body : result.bodies) body.actor->release();
+			chunk.state = ChunkState::Unloaded;
+			continue;
+		}
+		chunk.pending.swap(result.bodies);
+		chunk.state = ChunkState::Inserting;
+	}
+	drained.clear();
+
+	// removals first: they free the slots and scene memory the inserts are about to use
+	unsigned int budget = settings.maxRemovalsPerFrame;
+	for (unsigned int index : active) {
+		Chunk& chunk = chunks[index];
+		if (chunk.state != ChunkState::Removing) continue;
+		AuditPhaseScope spawn(FramePhase::Spawn);
+		removeBodies(chunk, cubes, budget);
+		if (!chunk.pending.empty() || !chunk.slots.empty()) break;
+
+		std::vector<StreamedBody>().swap(chunk.pending);
+		std::vector<size_t>().swap(chunk.slots);
+		chunk.state = ChunkState::Unloaded;
+		if (chunk.wanted) {
+			// came back into range while it was being removed
+			chunk.state = ChunkState::Loading;
+			request(index);
+		}
+	}
+
+	budget = settings.maxInsertsPerFrame;
+	for (unsigned int index : active) {
+		Chunk& chunk = chunks[index];
+		if (chunk.state != ChunkState::Inserting) continue;
+		AuditPhaseScope spawn(FramePhase::Spawn);
+		insertBodies(chunk, cubes, materials, budget);
+		if (!chunk.pending.empty()) break;
+		chunk.state = ChunkState::Loaded;
+	}
+
+	for (size_t i = 0; i < active.size();) {
+		if (chunks[active[i]].state == ChunkState::Unloaded) {
+			active[i] = active.back();
+			active.pop_back();
+		}
+		else {
+			i++;
+		}
+	}
+}
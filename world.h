@@ -0,0 +1,149 @@
+#pragma once
+#include <PxPhysicsAPI.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "objects.h"
+
+class MaterialTable;
+
+// world file layout: WorldFileHeader, chunksX * chunksZ WorldChunkEntry, then the
+// ChunkBody records of every chunk back to back. Read through a file mapping so a
+// chunk costs nothing until the loader thread touches its pages
+struct WorldFileHeader {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int chunksX;
+	unsigned int chunksZ;
+	float chunkSize;
+	float originX;
+	float originZ;
+	unsigned int bodyCount;
+};
+
+struct WorldChunkEntry {
+	unsigned long long offset; // of the first ChunkBody from the start of the file
+	unsigned int bodyCount;
+	unsigned int reserved;
+};
+
+struct ChunkBody {
+	float position[3];
+	float halfExtents[3];
+	float color[3];
+	unsigned int kind; // BodyKind, only cubes for now
+};
+
+struct WorldGenSettings {
+	unsigned int chunksX = 32;
+	unsigned int chunksZ = 32;
+	float chunkSize = 16.0f;
+	unsigned int towersPerChunk = 2;
+	unsigned int minTowerHeight = 2;
+	unsigned int maxTowerHeight = 6;
+	unsigned int seed = 1;
+};
+
+// writes a world of small cube towers, centred on the origin
+bool generateWorld(const char* path, const WorldGenSettings& settings);
+
+class WorldFile {
+public:
+	~WorldFile();
+
+	bool open(const char* path);
+	void close();
+	bool isOpen() const { return view != nullptr; }
+
+	const WorldFileHeader& header() const { return *(const WorldFileHeader*)view; }
+	const WorldChunkEntry& chunk(unsigned int index) const;
+	const ChunkBody* bodies(unsigned int index) const;
+
+private:
+	void* file = nullptr;
+	void* mapping = nullptr;
+	const unsigned char* view = nullptr;
+	unsigned long long size = 0;
+};
+
+struct WorldStreamSettings {
+	int loadRadius = 2;                   // chunks around the focus that get loaded
+	int unloadRadius = 3;                 // chunks further than this get removed
+	unsigned int maxInsertsPerFrame = 128; // actors added to the scene per update
+	unsigned int maxRemovalsPerFrame = 128;
+};
+
+// pages chunks in and out around a focus point. Actors are built on a loader
+// thread and only the scene insert/remove happens on the caller, in bounded batches.
+// Streamed bodies live in the caller's cube array, reusing slots freed by earlier unloads
+class WorldStreamer {
+public:
+	WorldStreamSettings settings;
+
+	~WorldStreamer();
+
+	bool open(const char* path);
+	void close();
+	// the colors stored in the file are mapped to materials as bodies enter the scene
+	void update(const physx::PxVec3& focus, std::vector<Cube>& cubes, MaterialTable& materials);
+
+	// slots emptied / filled by the last update, removals come first when a slot is reused
+	const std::vector<size_t>& removedSlots() const { return removed; }
+	const std::vector<size_t>& insertedSlots() const { return inserted; }
+	unsigned int residentChunks() const;
+	unsigned int pendingLoads() const { return loadsInFlight; }
+
+private:
+	enum class ChunkState : unsigned char {
+		Unloaded,
+		Loading,   // queued or being built on the loader thread
+		Inserting, // built, waiting for insert budget
+		Loaded,
+		Removing
+	};
+
+	struct StreamedBody {
+		physx::PxRigidDynamic* actor;
+		glm::vec3 scale;
+		glm::vec3 color;
+	};
+
+	struct Chunk {
+		ChunkState state = ChunkState::Unloaded;
+		bool wanted = false;
+		std::vector<StreamedBody> pending; // built but not in the scene yet
+		std::vector<size_t> slots;         // cube slots in the scene
+	};
+
+	struct LoadResult {
+		unsigned int chunk;
+		std::vector<StreamedBody> bodies;
+	};
+
+	WorldFile world;
+	std::vector<Chunk> chunks;
+	std::vector<unsigned int> active; // chunks not Unloaded
+	std::vector<size_t> freeSlots;
+	std::vector<size_t> removed;
+	std::vector<size_t> inserted;
+	std::vector<physx::PxActor*> batch;
+	int focusX = 0x7FFFFFFF;
+	int focusZ = 0x7FFFFFFF;
+	unsigned int loadsInFlight = 0;
+
+	std::thread loader;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<unsigned int> requests;
+	std::vector<LoadResult> results;
+	std::vector<LoadResult> drained;
+	bool stopping = false;
+
+	void loaderMain();
+	void request(unsigned int chunk);
+	void refreshWanted(int cx, int cz);
+	void removeBodies(Chunk& chunk, std::vector<Cube>& cubes, unsigned int& budget);
+	void insertBodies(Chunk& chunk, std::vector<Cube>& cubes, MaterialTable& materials, unsigned int& budget);
+};